@@ -0,0 +1,130 @@
+/**
+    ESP_CompressionBenchmark
+    Example comparing compressed and uncompressed polling.
+    Send messages to the bot, the mode is switched every
+    UPDATES_PER_ROUND updates and both modes are reported with the
+    bytes received and the time spent per update.
+
+    Part of TelegramBotClient (https://github.com/schlingensiepen/TelegramBotClient)
+    Jörn Schlingensiepen <joern@schlingensiepen.com>
+
+    Client's API:   https://schlingensiepen.github.io/TelegramBotClient/
+    Telegram's API: https://core.telegram.org/bots/api
+*/
+
+#include <ESP8266WiFi.h>
+#include <WiFiClientSecure.h>
+
+#include <TelegramBotClient.h>
+
+// Instantiate Wifi connection credentials
+const char* ssid     = "digitalisierung";
+const char* password = "cloudification";
+
+// Instantiate Telegram Bot secure token
+// This is provided by BotFather
+const String botToken = "YOUR BOT TOKEN";
+
+// Number of updates received in each mode before switching
+#define UPDATES_PER_ROUND 10
+
+// Instantiate the ssl client used to communicate with Telegram's web API
+WiFiClientSecure sslPollClient;
+
+// Instantiate the client with secure token and client
+TelegramBotClient client(
+      botToken,
+      sslPollClient);
+
+// Measurements of a mode, index 0 uncompressed, 1 compressed
+struct Measurement
+{
+  unsigned long Updates = 0;
+  unsigned long Bytes = 0;
+  unsigned long LoopMicros = 0;
+  unsigned long ProcessMicros = 0;
+} measurements[2];
+
+bool compressed = false;
+unsigned long roundBytes = 0;
+unsigned long roundProcessMicros = 0;
+unsigned long roundLoopMicros = 0;
+unsigned long roundUpdates = 0;
+
+void printMeasurement(const char* name, Measurement& m)
+{
+  if (m.Updates == 0) return;
+  Serial.print(name);
+  Serial.print(" updates: "); Serial.print(m.Updates);
+  Serial.print(" bytes/update: "); Serial.print(m.Bytes / m.Updates);
+  Serial.print(" loop us/update: "); Serial.print(m.LoopMicros / m.Updates);
+  Serial.print(" inflate+parse us/update: "); Serial.println(m.ProcessMicros / m.Updates);
+}
+
+// Function called on receiving a message
+void onReceive (TelegramProcessError tbcErr, JwcProcessError jwcErr, Message* msg)
+{
+  roundUpdates++;
+  if (roundUpdates < UPDATES_PER_ROUND) return;
+
+  // account the round to the current mode and switch
+  Measurement& m = measurements[compressed ? 1 : 0];
+  m.Updates += roundUpdates;
+  m.Bytes += client.bytesReceived() - roundBytes;
+  m.ProcessMicros += client.processMicros() - roundProcessMicros;
+  m.LoopMicros += roundLoopMicros;
+  printMeasurement("identity", measurements[0]);
+  printMeasurement("gzip    ", measurements[1]);
+
+  compressed = !compressed;
+  client.setCompression(compressed);
+  roundUpdates = 0;
+  roundLoopMicros = 0;
+  roundBytes = client.bytesReceived();
+  roundProcessMicros = client.processMicros();
+}
+
+// Function called if an error occures
+void onError (TelegramProcessError tbcErr, JwcProcessError jwcErr)
+{
+  Serial.println("onError");
+  Serial.print("tbcErr"); Serial.print((int)tbcErr); Serial.print(":"); Serial.println(toString(tbcErr));
+  Serial.print("jwcErr"); Serial.print((int)jwcErr); Serial.print(":"); Serial.println(toString(jwcErr));
+}
+
+// Setup WiFi connection using credential defined at begin of file
+void setupWiFi()
+{
+  Serial.println();
+  Serial.printf("Try to connect to network %s ",ssid);
+  Serial.println();
+
+  WiFi.begin(ssid, password);
+  Serial.print(".");
+  while (WiFi.status() != WL_CONNECTED) {
+    delay(500);
+    Serial.print(".");
+  }
+  Serial.println();
+  Serial.println("OK");
+  Serial.print("IP address .: ");
+  Serial.println(WiFi.localIP());
+}
+
+// Setup
+void setup() {
+  Serial.begin(115200);
+  delay(10);
+  setupWiFi();
+  client.begin(
+      onReceive,
+      onError);
+}
+
+// Loop
+void loop() {
+  // the time spent in loop() includes reading and decrypting the responses
+  unsigned long start = micros();
+  client.loop();
+  roundLoopMicros += micros() - start;
+}
@@ -0,0 +1,97 @@
+/**
+    ESP_SessionResumption
+    Example measuring the time of TLS handshakes with and without
+    resuming sessions by a TBCSessionCache. Connects to Telegram's API
+    host ROUNDS times in each mode and reports the average time of a
+    connect including the handshake.
+
+    Part of TelegramBotClient (https://github.com/schlingensiepen/TelegramBotClient)
+    Jörn Schlingensiepen <joern@schlingensiepen.com>
+
+    Client's API:   https://schlingensiepen.github.io/TelegramBotClient/
+    Telegram's API: https://core.telegram.org/bots/api
+*/
+
+#include <ESP8266WiFi.h>
+#include <WiFiClientSecure.h>
+
+#include <TelegramBotClient.h>
+#include <TBCSessionCache.h>
+
+// Instantiate Wifi connection credentials
+const char* ssid     = "digitalisierung";
+const char* password = "cloudification";
+
+// Number of connects in each mode
+#define ROUNDS 10
+
+// Instantiate the ssl client and the session cache
+WiFiClientSecure sslClient;
+TBCSessionCache sessions;
+
+// Callbacks of the JsonWebClient, not called as no request is sent
+void onSuccess (JwcProcessError err, JsonObject& json) {}
+void onError (JwcProcessError err, Client* client) {}
+
+JsonWebClient webClient(
+      &sslClient, TBC_TELEGRAM_HOST, TELEGRAMPORT,
+      onSuccess, onError);
+
+// Returns the average connect time in microseconds
+unsigned long measure()
+{
+  unsigned long sum = 0;
+  for (int i = 0; i <= ROUNDS; i++)
+  {
+    if (!webClient.beginRequest())
+    {
+      Serial.println("connect failed");
+      return 0;
+    }
+    // the first connect of a mode may not find a session
+    if (i > 0) sum += webClient.connectMicros();
+    webClient.stop();
+  }
+  return sum / ROUNDS;
+}
+
+// Setup WiFi connection using credential defined at begin of file
+void setupWiFi()
+{
+  Serial.println();
+  Serial.printf("Try to connect to network %s ",ssid);
+  Serial.println();
+
+  WiFi.begin(ssid, password);
+  Serial.print(".");
+  while (WiFi.status() != WL_CONNECTED) {
+    delay(500);
+    Serial.print(".");
+  }
+  Serial.println();
+  Serial.println("OK");
+  Serial.print("IP address .: ");
+  Serial.println(WiFi.localIP());
+}
+
+// Setup
+void setup() {
+  Serial.begin(115200);
+  delay(10);
+  setupWiFi();
+  // the certificate is not verified in this measurement
+  sslClient.setInsecure();
+  sessions.add(sslClient);
+}
+
+// Loop
+void loop() {
+  webClient.setConnectionHook(JwcConnectionHook());
+  unsigned long full = measure();
+  webClient.setConnectionHook(sessions.hook());
+  unsigned long resumed = measure();
+  sessions.clear();
+  Serial.print("full handshake us: "); Serial.print(full);
+  Serial.print(" resumed us: "); Serial.println(resumed);
+  delay(10000);
+}
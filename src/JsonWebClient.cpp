@@ -12,119 +12,764 @@
 
 #include "JsonWebClient.h"
 
+const __FlashStringHelper* toString(JwcProcessError err)
+{
+  switch (err)
+  {
+    case JwcProcessError::Ok: return F("Ok");
+    case JwcProcessError::HttpErr: return F("HttpErr");
+    case JwcProcessError::MsgTooBig: return F("MsgTooBig");
+    case JwcProcessError::MsgJsonErr: return F("MsgJsonErr");
+    case JwcProcessError::ConnLost: return F("ConnLost");
+  }
+  return F("Unknown");
+}
+
+const __FlashStringHelper* toString(JwcClientState state)
+{
+  switch (state)
+  {
+    case JwcClientState::Unconnected: return F("Unconnected");
+    case JwcClientState::Connected: return F("Connected");
+    case JwcClientState::Waiting: return F("Waiting");
+    case JwcClientState::Headers: return F("Headers");
+    case JwcClientState::Json: return F("Json");
+  }
+  return F("Unknown");
+}
+
 JsonWebClient::JsonWebClient (
   Client* netClient,
-  String host,
+  const char* host,
   int port,
-  void* callBackObject,
-  JWC_CALLBACK_MESSAGE_SIGNATURE,
-  JWC_CALLBACK_ERROR_SIGNATURE)
+  JwcMessageCallback callbackSuccess,
+  JwcErrorCallback callbackError)
 {
   DOUT ("New JsonWebClient");
   this->NetClient = netClient;
   this->State = JwcClientState::Unconnected;
   this->Host = host;
   this->Port = port;
-  this->CallBackObject = callBackObject;
   this->callbackSuccess = callbackSuccess;
   this->callbackError = callbackError;
 }
+JsonWebClient::~JsonWebClient()
+{
+  delete (Scanner);
+}
+
 void JsonWebClient::reConnect()
 {
   DOUT ("reConnect");
+  if (Pending > 0) dropConnection();
 #ifdef ESP8266
   DOUTKV("ESP.getFreeHeap()", ESP.getFreeHeap());
 #endif
   if (NetClient->connected())
   {
     DOUT ("stop");
-    NetClient->stop();
+    closeClient();
   }
   DOUT ("connecting ...");
+  if (callbackConnection)
+    callbackConnection(JwcConnectionEvent::BeforeConnect, this->NetClient);
+  unsigned long start = micros();
   this->State =
-    (NetClient->connect(this->Host.c_str(), this->Port) == 1)
+    (connectHost() == 1)
     ? JwcClientState::Connected
     : JwcClientState::Unconnected;
+  ConnectMicros = micros() - start;
+  Connects++;
+  DOUTKV ("ConnectMicros", ConnectMicros);
+  if (State == JwcClientState::Connected && callbackConnection)
+    callbackConnection(JwcConnectionEvent::AfterConnect, this->NetClient);
   DOUT ("connected");
-  long ContentLength = JWC_BUFF_SIZE;
-  bool HttpStatusOk = false;
+  Pending = 0;
+  resetResponse();
+}
+
+int JsonWebClient::connectHost()
+{
+  IPAddress address;
+  if (AddressCache != 0 && AddressCache->lookup(this->Host, address))
+  {
+    if (NetClient->connect(address, this->Port) == 1) return 1;
+    DOUT ("Connecting to cached address failed");
+    AddressCache->invalidate(this->Host);
+  }
+  return NetClient->connect(this->Host, this->Port);
+}
+
+void JsonWebClient::resetResponse()
+{
+  ContentLength = -1;
+  HttpStatusOk = false;
+  StatusCode = 0;
+  RetryAfter = -1;
+  Times.ServerDate = 0;
+  Scanning = false;
+  Chunked = false;
+  ChunkState = JwcChunkState::Size;
+  ChunkRemaining = 0;
+  ConnectionClose = false;
+  Encoding = JwcContentEncoding::Identity;
+  LineLength = 0;
+}
+
+void JsonWebClient::finishResponse()
+{
+  if (Pending > 0) Pending--;
+  DOUTKV ("Pending", Pending);
+  bool keepAlive = KeepAlive && !ConnectionClose && NetClient->connected();
+  resetResponse();
+  if (keepAlive)
+  {
+    State = (Pending > 0) ? JwcClientState::Waiting : JwcClientState::Connected;
+  }
+  else
+  {
+    // pending requests are reported as lost when the server closes
+    State = (Pending > 0) ? JwcClientState::Waiting : JwcClientState::Unconnected;
+  }
+}
+
+void JsonWebClient::dropConnection()
+{
+  bool lost = Pending > 0;
+  stop();
+  if (lost)
+  {
+    DOUT("Requests lost");
+    if (callbackError)
+      callbackError(JwcProcessError::ConnLost, this->NetClient);
+  }
+}
+
+void JsonWebClient::closed()
+{
+  if (State == JwcClientState::Json && ContentLength < 0 && !Chunked)
+  {
+    // body without content length ends with the connection
+    if (RawSink != 0)
+    {
+      finishRaw();
+      return;
+    }
+    if (Body != 0)
+    {
+      processJson();
+      return;
+    }
+  }
+  dropConnection();
+}
+
+void JsonWebClient::closeClient()
+{
+  if (callbackConnection)
+    callbackConnection(JwcConnectionEvent::BeforeClose, this->NetClient);
+  NetClient->stop();
 }
 
 bool JsonWebClient::stop()
 {
   DOUT("stop");
-  NetClient->stop();
+  closeClient();
   State = JwcClientState::Unconnected;
+  Pending = 0;
+  RawSink = 0;
+  releaseBody();
+  resetResponse();
   return true;
 }
 
-bool JsonWebClient::processHeader()
+void JsonWebClient::setRawSink(Print* sink, JwcRawCallback callbackRaw)
+{
+  DOUT("setRawSink");
+  this->RawSink = sink;
+  this->RawReceived = 0;
+  this->callbackRaw = callbackRaw;
+}
+
+void JsonWebClient::setBuffer(size_t size, char* storage)
+{
+  DOUTKV("setBuffer", size);
+  releaseBody();
+  BufferSize = size;
+  Buffer = storage;
+}
+
+size_t JsonWebClient::bufferSize()
+{
+  return BufferSize;
+}
+
+void JsonWebClient::setKeepAlive(bool keepAlive)
+{
+  DOUTKV("setKeepAlive", keepAlive);
+  KeepAlive = keepAlive;
+}
+
+uint8_t JsonWebClient::pending()
+{
+  return Pending;
+}
+
+/**
+    \brief Matches a header name
+
+    \param [in] line Header line
+    \param [in] name Header name including colon stored in flash
+    \return Pointer to the value of the header, 0 if the name does not match
+*/
+static const char* headerValue(const char* line, PGM_P name)
+{
+  size_t length = strlen_P(name);
+  if (strncasecmp_P(line, name, length) != 0) return 0;
+  line += length;
+  while (*line == ' ' || *line == '\t') line++;
+  return line;
+}
+
+/**
+    \brief Checks if a header value contains a token
+
+    \param [in] value Header value
+    \param [in] token Token stored in flash
+    \return True if the value contains the token, ignoring case
+*/
+static bool headerHasToken(const char* value, PGM_P token)
 {
-  String header = NetClient->readStringUntil('\n');
-  DOUTKV("Got header", header);
-  if (header.startsWith("Content-Length:"))
+  size_t length = strlen_P(token);
+  for (; *value != 0; value++)
+  {
+    if (strncasecmp_P(value, token, length) == 0) return true;
+  }
+  return false;
+}
+
+/**
+    \brief Parses a http date
+
+    \param [in] value Date like "Sun, 18 Oct 2026 12:00:00 GMT"
+    \return Seconds since 1970, 0 if the date can not be parsed
+*/
+static unsigned long parseHttpDate(const char* value)
+{
+  const char* comma = strchr(value, ',');
+  if (comma == 0) return 0;
+  char* next;
+  long day = strtol(comma + 1, &next, 10);
+  while (*next == ' ') next++;
+  PGM_P months = PSTR("JanFebMarAprMayJunJulAugSepOctNovDec");
+  long month = 0;
+  while (month < 12 && strncasecmp_P(next, months + 3 * month, 3) != 0) month++;
+  if (month == 12) return 0;
+  long year = strtol(next + 3, &next, 10);
+  long hour = strtol(next, &next, 10);
+  if (*next != ':') return 0;
+  long minute = strtol(next + 1, &next, 10);
+  if (*next != ':') return 0;
+  long second = strtol(next + 1, &next, 10);
+  // days since 1970 of the proleptic gregorian calendar, years start in march
+  month++;
+  if (month <= 2) year--;
+  long era = year / 400;
+  long yearOfEra = year - era * 400;
+  long dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  long dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+  long days = era * 146097 + dayOfEra - 719468;
+  if (days < 0) return 0;
+  return (unsigned long) days * 86400UL + hour * 3600UL + minute * 60UL + second;
+}
+
+void JsonWebClient::processHeaderLine()
+{
+  DOUTKV("Got header", Line);
+  const char* value;
+  if (StatusCode == 0)
+  {
+    // status line: HTTP/1.1 200 OK
+    value = headerValue(Line, PSTR("HTTP/"));
+    if (value != 0)
+    {
+      while (*value != 0 && *value != ' ') value++;
+      StatusCode = atoi(value);
+      HttpStatusOk = StatusCode >= 200 && StatusCode < 300;
+      DOUTKV ("StatusCode", StatusCode);
+    }
+  }
+  else if ((value = headerValue(Line, PSTR("Content-Length:"))) != 0)
   {
-    ContentLength = header.substring(15).toInt(); //TODO check for error
+    ContentLength = atol(value);
     DOUTKV ("ContentLength", ContentLength);
   }
-  if (header.startsWith(F("HTTP/1.1 200 OK")))
+  else if ((value = headerValue(Line, PSTR("Transfer-Encoding:"))) != 0)
   {
-    HttpStatusOk = true;
-    DOUTKV ("HttpStatusOk", HttpStatusOk);
+    Chunked = headerHasToken(value, PSTR("chunked"));
+    DOUTKV ("Chunked", Chunked);
+  }
+  else if ((value = headerValue(Line, PSTR("Connection:"))) != 0)
+  {
+    ConnectionClose = headerHasToken(value, PSTR("close"));
+    DOUTKV ("ConnectionClose", ConnectionClose);
+  }
+  else if ((value = headerValue(Line, PSTR("Retry-After:"))) != 0)
+  {
+    RetryAfter = atol(value);
+    DOUTKV ("RetryAfter", RetryAfter);
+  }
+  else if ((value = headerValue(Line, PSTR("Content-Encoding:"))) != 0)
+  {
+    if (headerHasToken(value, PSTR("gzip"))) Encoding = JwcContentEncoding::Gzip;
+    else if (headerHasToken(value, PSTR("deflate"))) Encoding = JwcContentEncoding::Deflate;
+    else if (!headerHasToken(value, PSTR("identity"))) Encoding = JwcContentEncoding::Unknown;
+    DOUTKV ("Encoding", (int) Encoding);
+  }
+  else if ((value = headerValue(Line, PSTR("Date:"))) != 0)
+  {
+    Times.ServerDate = parseHttpDate(value);
+    DOUTKV ("ServerDate", Times.ServerDate);
+  }
+}
+
+bool JsonWebClient::processHeader()
+{
+  while (NetClient->available() > 0)
+  {
+    int c = NetClient->read();
+    if (c < 0) break;
+    BytesReceived++;
+    if (c != '\n')
+    {
+      // overlong lines are truncated, the interesting headers are short
+      if (c != '\r' && LineLength < JWC_LINE_SIZE - 1) Line[LineLength++] = (char) c;
+      continue;
+    }
+    Line[LineLength] = 0;
+    bool endOfHeaders = (LineLength == 0); // End of headers by empty line --> http
+    if (!endOfHeaders) processHeaderLine();
+    LineLength = 0;
+    return !endOfHeaders;
   }
-  if (header == "\r") return false; // End of headers by empty line --> http
   return true;
 }
-bool JsonWebClient::processJson()
+
+int JsonWebClient::statusCode()
+{
+  return StatusCode;
+}
+
+long JsonWebClient::retryAfter()
+{
+  return RetryAfter;
+}
+
+bool JsonWebClient::chunked()
+{
+  return Chunked;
+}
+
+bool JsonWebClient::connectionClose()
+{
+  return ConnectionClose;
+}
+
+JwcContentEncoding JsonWebClient::contentEncoding()
+{
+  return Encoding;
+}
+
+void JsonWebClient::setCompression(bool compression)
 {
+  DOUTKV("setCompression", compression);
+  Compression = compression;
+}
+
+void JsonWebClient::acceptEncoding()
+{
+  if (Compression) NetClient->println(F("Accept-Encoding: gzip, deflate"));
+}
+
+unsigned long JsonWebClient::bytesReceived()
+{
+  return BytesReceived;
+}
+
+unsigned long JsonWebClient::processMicros()
+{
+  return ProcessMicros;
+}
+
+const JwcTimes& JsonWebClient::times()
+{
+  return Times;
+}
+
+void JsonWebClient::fail(JwcProcessError err)
+{
+  if (Pending > 0) Pending--;
+  RawSink = 0;
+  if (callbackError)
+    callbackError(err, this->NetClient);
+  releaseBody();
+  dropConnection();
+}
+
+const char* JsonWebClient::bodyHead()
+{
+  if (Body == 0) return "";
+  Body[BodyLength] = 0;
+  return Body;
+}
+
+void JsonWebClient::releaseBody()
+{
+  if (Body != 0 && Body != Buffer) free(Body);
+  Body = 0;
+  BodyLength = 0;
+}
+
+int JsonWebClient::readBody(uint8_t* buffer, size_t count)
+{
+  if (!Chunked)
+  {
+    int read = NetClient->read(buffer, count);
+    return (read > 0) ? read : 0;
+  }
+  size_t done = 0;
+  while (NetClient->available() > 0
+         && ChunkState != JwcChunkState::Done
+         && ChunkState != JwcChunkState::Error)
+  {
+    if (ChunkState == JwcChunkState::Data)
+    {
+      if (done == count) break;
+      size_t length = count - done;
+      if (length > ChunkRemaining) length = ChunkRemaining;
+      int read = NetClient->read(buffer + done, length);
+      if (read <= 0) break;
+      done += read;
+      ChunkRemaining -= read;
+      if (ChunkRemaining == 0) ChunkState = JwcChunkState::DataEnd;
+      continue;
+    }
+    // framing lines, the headers are complete and Line is free
+    int c = NetClient->read();
+    if (c < 0) break;
+    BytesReceived++;
+    if (c != '\n')
+    {
+      if (c != '\r' && LineLength < JWC_LINE_SIZE - 1) Line[LineLength++] = (char) c;
+      continue;
+    }
+    Line[LineLength] = 0;
+    switch (ChunkState)
+    {
+      case JwcChunkState::Size: {
+          // chunk extensions following the size are ignored
+          char* end;
+          ChunkRemaining = strtoul(Line, &end, 16);
+          if (end == Line)
+          {
+            DOUT("Malformed chunk size");
+            ChunkState = JwcChunkState::Error;
+            break;
+          }
+          DOUTKV("Chunk", ChunkRemaining);
+          ChunkState = (ChunkRemaining > 0) ? JwcChunkState::Data : JwcChunkState::Trailer;
+          break;
+        }
+      case JwcChunkState::DataEnd: {
+          ChunkState = JwcChunkState::Size;
+          break;
+        }
+      case JwcChunkState::Trailer: {
+          if (LineLength == 0) ChunkState = JwcChunkState::Done;
+          break;
+        }
+      default:
+        break;
+    }
+    LineLength = 0;
+  }
+  if (ChunkState == JwcChunkState::Error) return -1;
+  return done;
+}
+
+bool JsonWebClient::processBody()
+{
+  if (AckFilter && Encoding == JwcContentEncoding::Identity) return scanBody();
   if (!HttpStatusOk)
   {
     DOUT("!HttpStatusOk");
-    if (callbackError != 0 && CallBackObject != 0)
-      callbackError(this->CallBackObject, JwcProcessError::HttpErr, this->NetClient);
-    stop();
+    fail(JwcProcessError::HttpErr);
     return false;
   }
-  DOUT("Parsing JSON");
-  if (ContentLength > JWC_BUFF_SIZE)
+  if (Body == 0)
+  {
+    // an oversized body is read up to the buffer size, the caller
+    // learns from its head what was skipped
+    BodySize = (ContentLength >= 0 && ContentLength < (long) BufferSize)
+               ? ContentLength : BufferSize;
+    // a compressed body is inflated into the buffer, it is kept aside
+    bool compressed = Encoding != JwcContentEncoding::Identity;
+    Body = (Buffer != 0 && !compressed) ? Buffer : (char*) malloc(BodySize + 1);
+    BodyLength = 0;
+    if (Body == 0)
+    {
+      DOUT("Out of memory");
+      fail(JwcProcessError::MsgTooBig);
+      return false;
+    }
+  }
+  // take only what is already received, never wait for more
+  size_t count = NetClient->available();
+  if (count > BodySize - BodyLength) count = BodySize - BodyLength;
+  if (count > 0 || (Chunked && NetClient->available() > 0))
+  {
+    int read = readBody((uint8_t*) Body + BodyLength, count);
+    if (read < 0)
+    {
+      fail(JwcProcessError::MsgJsonErr);
+      return false;
+    }
+    BodyLength += read;
+    BytesReceived += read;
+  }
+  DOUTKV("BodyLength", BodyLength);
+  if (chunksDone()) return processJson();
+  if (BodyLength < BodySize) return true;
+  // the framing following a full buffer may still end the body
+  if (Chunked && ChunkState != JwcChunkState::Data) return true;
+  if (Chunked || ContentLength > (long) BufferSize
+      || (ContentLength < 0 && NetClient->available() > 0))
   {
     DOUT("Message to big to parse");
-    if (callbackError != 0 && CallBackObject != 0)
-      callbackError(this->CallBackObject, JwcProcessError::MsgTooBig, this->NetClient);
-    stop();
+    // the head of a compressed body tells nothing
+    if (Encoding != JwcContentEncoding::Identity) releaseBody();
+    fail(JwcProcessError::MsgTooBig);
+    return false;
+  }
+  return processJson();
+}
+
+void JsonWebClient::setAckFilter(bool ackFilter)
+{
+  DOUTKV("setAckFilter", ackFilter);
+  if (ackFilter && Scanner == 0) Scanner = new JwcAckScanner();
+  AckFilter = ackFilter;
+}
+
+void JsonWebClient::setConnectionHook(JwcConnectionHook callbackConnection)
+{
+  DOUT("setConnectionHook");
+  this->callbackConnection = callbackConnection;
+}
+
+void JsonWebClient::setAddressCache(TBCAddressCache* cache)
+{
+  DOUT("setAddressCache");
+  this->AddressCache = cache;
+}
+
+unsigned long JsonWebClient::connectMicros()
+{
+  return ConnectMicros;
+}
 
+unsigned long JsonWebClient::connects()
+{
+  return Connects;
+}
+
+const JwcAck& JsonWebClient::ack()
+{
+  if (Scanner == 0) Scanner = new JwcAckScanner();
+  return Scanner->ack();
+}
+
+bool JsonWebClient::scanBody()
+{
+  if (!Scanning)
+  {
+    Scanner->reset();
+    Scanning = true;
+    Scanned = 0;
+  }
+  uint8_t buffer[JWC_RAW_CHUNK];
+  size_t count = NetClient->available();
+  if (count > JWC_RAW_CHUNK) count = JWC_RAW_CHUNK;
+  if (ContentLength >= 0 && (size_t) ContentLength - Scanned < count)
+    count = (size_t) ContentLength - Scanned;
+  int read = count > 0 ? readBody(buffer, count) : 0;
+  if (read < 0)
+  {
+    fail(JwcProcessError::MsgJsonErr);
     return false;
   }
-  DynamicJsonBuffer jsonBuffer (JWC_BUFF_SIZE);
-  JsonObject& payload = jsonBuffer.parse(*NetClient);
+  if (read > 0)
+  {
+    Scanner->feed(buffer, read);
+    Scanned += read;
+    BytesReceived += read;
+  }
+  // a chunked body is read up to its end, the connection is kept
+  bool complete = Chunked ? chunksDone()
+                  : (ContentLength >= 0)
+                  ? Scanned >= (size_t) ContentLength
+                  : Scanner->ack().Complete;
+  if (!complete) return true;
+  DOUTKV("Scanned", Scanned);
+  if (!HttpStatusOk)
+  {
+    DOUT("!HttpStatusOk");
+    DOUTKV("Description", Scanner->ack().Description);
+    fail(JwcProcessError::HttpErr);
+    return false;
+  }
+  // switch state before the callback, it may fire the next request
+  finishResponse();
+  if (callbackSuccess)
+    callbackSuccess(JwcProcessError::Ok, JsonObject::invalid());
+  return true;
+}
+
+bool JsonWebClient::inflateBody()
+{
+  DOUTKV("Inflating", BodyLength);
+  if (Encoding == JwcContentEncoding::Unknown)
+  {
+    DOUT("Unsupported content encoding");
+    fail(JwcProcessError::MsgJsonErr);
+    return false;
+  }
+  // the parse buffer is the window of the inflater as well
+  char* plain = (Buffer != 0) ? Buffer : (char*) malloc(BufferSize + 1);
+  JwcInflater* inflater = (plain != 0) ? new JwcInflater((uint8_t*) plain, BufferSize) : 0;
+  if (inflater == 0)
+  {
+    DOUT("Out of memory");
+    if (plain != 0 && plain != Buffer) free(plain);
+    fail(JwcProcessError::MsgTooBig);
+    return false;
+  }
+  long length = inflater->inflate((const uint8_t*) Body, BodyLength);
+  bool overflow = inflater->overflow();
+  delete inflater;
+  releaseBody();
+  Body = plain;
+  BodySize = BufferSize;
+  BodyLength = (length >= 0) ? length : 0;
+  if (overflow)
+  {
+    // the head of the body is kept for the error callback
+    DOUT("Message to big to parse");
+    BodyLength = BufferSize;
+    fail(JwcProcessError::MsgTooBig);
+    return false;
+  }
+  if (length < 0)
+  {
+    fail(JwcProcessError::MsgJsonErr);
+    return false;
+  }
+  return true;
+}
+
+bool JsonWebClient::processJson()
+{
+  unsigned long start = micros();
+  if (Encoding != JwcContentEncoding::Identity && !inflateBody()) return false;
+  DOUT("Parsing JSON");
+  Body[BodyLength] = 0;
+  // the body is parsed in place, strings in the json point into it
+  char* body = Body;
+  Body = 0;
+  BodyLength = 0;
+  DynamicJsonBuffer jsonBuffer (BufferSize);
+  JsonObject& payload = jsonBuffer.parseObject(body);
   if (!payload.success())
   {
     DOUT("Skip message, JSON error");
-    if (callbackError != 0 && CallBackObject != 0)
-      callbackError(this->CallBackObject, JwcProcessError::MsgJsonErr, this->NetClient);
-    stop();
+    if (body != Buffer) free(body);
+    ProcessMicros += micros() - start;
+    fail(JwcProcessError::MsgJsonErr);
     return false;
   }
 
   DOUT("Message successfully parsed.");
+  Times.Parsed = micros();
+  ProcessMicros += Times.Parsed - start;
 
-  if (callbackSuccess != 0 && CallBackObject != 0)
-    callbackSuccess(this->CallBackObject, JwcProcessError::Ok, payload);
-  State = JwcClientState::Unconnected;
+  // switch state before the callback, it may fire the next request
+  finishResponse();
+  // the payload points into the static buffer until the callback returns
+  if (body == Buffer) BufferBusy = true;
+  if (callbackSuccess)
+    callbackSuccess(JwcProcessError::Ok, payload);
+  if (body == Buffer) BufferBusy = false;
+  else free(body);
   return true;
 }
-bool JsonWebClient::loop()
+
+bool JsonWebClient::processRaw()
+{
+  if (!HttpStatusOk)
+  {
+    DOUT("!HttpStatusOk");
+    fail(JwcProcessError::HttpErr);
+    return false;
+  }
+  uint8_t buffer[JWC_RAW_CHUNK];
+  size_t count = JWC_RAW_CHUNK;
+  if (ContentLength >= 0 && (size_t) ContentLength - RawReceived < count)
+    count = (size_t) ContentLength - RawReceived;
+  int read = count > 0 ? readBody(buffer, count) : 0;
+  if (read < 0)
+  {
+    fail(JwcProcessError::MsgJsonErr);
+    return false;
+  }
+  if (read > 0)
+  {
+    RawSink->write(buffer, read);
+    RawReceived += read;
+    BytesReceived += read;
+    DOUTKV("RawReceived", RawReceived);
+    if (callbackRaw)
+      callbackRaw(RawReceived, ContentLength);
+  }
+  if (chunksDone() || (ContentLength >= 0 && RawReceived >= (size_t) ContentLength)) finishRaw();
+  return true;
+}
+
+void JsonWebClient::finishRaw()
+{
+  DOUT("Raw data received");
+  RawSink = 0;
+  finishResponse();
+  if (callbackSuccess)
+    callbackSuccess(JwcProcessError::Ok, JsonObject::invalid());
+}
+
+bool JsonWebClient::loop(unsigned long budgetMicros)
 {
   bool res = false;
   if (State == JwcClientState::Unconnected) return res;
+  // called from a callback, the next response waits for the static buffer
+  if (BufferBusy) return res;
   if (!NetClient->connected() && NetClient->available() == 0)
   {
     DOUT("Client was not connected, setting to JwcClientState::Unconnected");
-    State = JwcClientState::Unconnected;
+    closed();
     return res;
   }
   if (State == JwcClientState::Connected) return res;
-  while (NetClient->available() > 0 && State != JwcClientState::Unconnected)
+  unsigned long start = micros();
+  while (NetClient->available() > 0
+         && State != JwcClientState::Unconnected
+         && State != JwcClientState::Connected)
   {
     res = true;
     DOUT ("Received data");
@@ -132,28 +777,42 @@ bool JsonWebClient::loop()
     {
       case JwcClientState::Waiting : {
           State = JwcClientState::Headers; DOUT ("Switch State to headers");
+          Times.FirstByte = micros();
           break;
         }
       case JwcClientState::Headers : {
           if (!processHeader()) {
             State = JwcClientState::Json;  DOUT ("Switch State to json");
+            Times.Headers = micros();
+            // an empty body is not announced by available()
+            if (ContentLength == 0) processContent();
           }
           break;
         }
       case JwcClientState::Json  : {
-          processJson();
+          processContent();
           break;
         }
+      default:
+        break;
     }
+    if (budgetMicros > 0 && (micros() - start) >= budgetMicros) break;
   }
-  if (!NetClient->connected() && NetClient->available() == 0)
+  if (State != JwcClientState::Unconnected
+      && !NetClient->connected() && NetClient->available() == 0)
   {
     DOUT("Client is not connected, setting to JwcClientState::unconnected");
-    State = JwcClientState::Unconnected;
+    closed();
   }
   return res;
 }
 
+bool JsonWebClient::processContent()
+{
+  if (RawSink != 0) return processRaw();
+  return processBody();
+}
+
 JwcClientState JsonWebClient::state()
 {
   return State;
@@ -162,18 +821,45 @@ JwcClientState JsonWebClient::state()
 bool JsonWebClient::fire (String commands[], int count)
 {
   DOUT ("Fire");
-  reConnect();
   DOUTKV ("count", count);
-
-  if (State != JwcClientState::Connected) return false;
-  if (!NetClient->connected()) return false;
+  if (!beginRequest()) return false;
   for (int i = 0; i < count; i++)
   {
     DOUTKV ("command", commands[i]);
+    // the empty line ends the headers
+    if (commands[i].length() == 0) acceptEncoding();
     NetClient->println(commands[i]);
   }
+  return endRequest();
+}
+
+bool JsonWebClient::beginRequest()
+{
+  DOUT ("beginRequest");
+  if (KeepAlive && State != JwcClientState::Unconnected && NetClient->connected())
+  {
+    DOUTKV ("Reusing connection, pending", Pending);
+    return true;
+  }
+  reConnect();
+  if (State != JwcClientState::Connected) return false;
+  if (!NetClient->connected()) return false;
+  return true;
+}
+
+Print& JsonWebClient::request()
+{
+  return *NetClient;
+}
+
+bool JsonWebClient::endRequest()
+{
+  DOUT ("endRequest");
+  if (State == JwcClientState::Unconnected) return false;
   NetClient->flush();
-  State = JwcClientState::Waiting;
+  Times.Fired = micros();
+  Pending++;
+  if (State == JwcClientState::Connected) State = JwcClientState::Waiting;
   loop();
+  return true;
 }
-
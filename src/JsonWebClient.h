@@ -17,6 +17,10 @@
 #include "Arduino.h"
 #include <Client.h>
 #include <ArduinoJson.h>
+#include "JwcInflater.h"
+#include "JwcAckScanner.h"
+#include "TBCAddressCache.h"
+#include "TBCDelegate.h"
 
 #ifndef JWC_BUFF_SIZE
 #ifdef ESP8266
@@ -26,6 +30,19 @@
 #endif
 #endif
 
+/** Size of the buffer holding a header line, longer lines are truncated */
+#ifndef JWC_LINE_SIZE
+#define JWC_LINE_SIZE 64
+#endif
+
+#ifndef JWC_RAW_CHUNK
+#ifdef ESP8266
+#define JWC_RAW_CHUNK 256
+#else
+#define JWC_RAW_CHUNK 512
+#endif
+#endif
+
 
 /**
    \class JwcProcessError
@@ -50,32 +67,61 @@ enum class JwcProcessError : int
   Ok = 0,
   /** Not found HTTP 200 Header --> Server Error */
   HttpErr    = -1,
-  /** Message bigger than JWC_BUFF_SIZE adjust JWC_BUFF_SIZE to avoid this,
+  /** Message bigger than the buffer, adjust JWC_BUFF_SIZE or
+      JsonWebClient::setBuffer() to avoid this,
       beware ArduinoJSON still needs to fit to your device's memory */
   MsgTooBig  = -2,
   /** ArduinoJSON was not able to parse the message */
-  MsgJsonErr = -3
+  MsgJsonErr = -3,
+  /** Connection was closed before all responses were received */
+  ConnLost = -4
 };
 
-/** Static list of JwcProcessError names */
-static String JwcProcessErrorString[] = {"Ok", "HttpErr", "MsgTooBig", "MsgJsonErr"};
+/**
+    \brief Name of a JwcProcessError
 
-static String toString(JwcProcessError err)
-{
-  return JwcProcessErrorString[(-1) * (int) err];
-}
+    \param [in] err The error
+    \return The name stored in flash
+*/
+const __FlashStringHelper* toString(JwcProcessError err);
 
 
 
-// Inspired by PubSubClient by Nick O'Leary (http://knolleary.net)
-#ifdef ESP8266
-#include <functional>
-#define JWC_CALLBACK_MESSAGE_SIGNATURE std::function<void(void*, JwcProcessError, JsonObject&)> callbackSuccess
-#define JWC_CALLBACK_ERROR_SIGNATURE std::function<void(void*, JwcProcessError, Client*)> callbackError
-#else
-#define JWC_CALLBACK_MESSAGE_SIGNATURE void (*callbackSuccess)(void*, JwcProcessError, JsonObject&)
-#define JWC_CALLBACK_ERROR_SIGNATURE void (*callbackError)(void*, JwcProcessError, Client*)
-#endif
+/** Callback called on receiving a message / valid json data */
+typedef TBCDelegate<void(JwcProcessError, JsonObject&)> JwcMessageCallback;
+/** Callback called on error while receiving */
+typedef TBCDelegate<void(JwcProcessError, Client*)> JwcErrorCallback;
+/** Callback called on copying data to a raw sink with the number of bytes
+    received so far and the content length (-1 if unknown) */
+typedef TBCDelegate<void(size_t, long)> JwcRawCallback;
+
+/**
+   \class JwcConnectionEvent
+
+   \file JsonWebClient.h
+
+   \brief JwcConnectionEvent event = JwcConnectionEvent::BeforeConnect;
+
+   Enumeration of the stages of a connection passed to a JwcConnectionHook.
+
+   \note Should only be used as a part of TelegramBotClient
+   (https://github.com/schlingensiepen/TelegramBotClient)
+
+   \author Jörn Schlingensiepen <joern@schlingensiepen.com>
+
+*/
+enum class JwcConnectionEvent : int
+{
+  /** Client is about to connect */
+  BeforeConnect = 0,
+  /** Client connected successfully, including the TLS handshake */
+  AfterConnect = 1,
+  /** Client is about to be stopped, also after the server closed */
+  BeforeClose = 2
+};
+
+/** Callback called at the stages of a connection, e.g. to resume TLS sessions */
+typedef TBCDelegate<void(JwcConnectionEvent, Client*)> JwcConnectionHook;
 
 /**
    \class JwcClientState
@@ -106,14 +152,125 @@ enum class JwcClientState : int
   Json = 4
 };
 
-/** Static list of JwcClientState names */
-static String JwcClientStateString[] = {"Unconnected", "Connected", "Waiting", "Headers", "Json"};
+/**
+    \brief Name of a JwcClientState
+
+    \param [in] state The state
+    \return The name stored in flash
+*/
+const __FlashStringHelper* toString(JwcClientState state);
+
 
-static String toString(JwcClientState state)
+/**
+   \class JwcContentEncoding
+
+   \file JsonWebClient.h
+
+   \brief JwcContentEncoding encoding = JwcContentEncoding::Identity;
+
+   Enumeration of the content encodings of a response.
+
+   \note Should only be used as a part of TelegramBotClient
+   (https://github.com/schlingensiepen/TelegramBotClient)
+
+   \author Jörn Schlingensiepen <joern@schlingensiepen.com>
+
+*/
+enum class JwcContentEncoding : int
 {
-  return JwcClientStateString[(int) state];
-}
+  /** Body is not encoded */
+  Identity = 0,
+  /** Body is compressed by gzip */
+  Gzip = 1,
+  /** Body is compressed by deflate */
+  Deflate = 2,
+  /** Body uses an unsupported encoding */
+  Unknown = 3
+};
+
+/**
+   \class JwcChunkState
+   @enum mapper::JwcChunkState
+
+   \file JsonWebClient.h
 
+   \brief JwcChunkState state = JwcChunkState::Size;
+
+   Enumeration of the parts of a body sent with Transfer-Encoding: chunked.
+
+   \note Should only be used as a part of TelegramBotClient
+   (https://github.com/schlingensiepen/TelegramBotClient)
+
+   \author Jörn Schlingensiepen <joern@schlingensiepen.com>
+
+*/
+enum class JwcChunkState : int
+{
+  /** Line holding the size of the next chunk */
+  Size = 0,
+  /** Data of a chunk */
+  Data = 1,
+  /** Line break ending the data of a chunk */
+  DataEnd = 2,
+  /** Trailer lines following the last chunk */
+  Trailer = 3,
+  /** Body complete */
+  Done = 4,
+  /** Chunk size line can not be parsed */
+  Error = 5
+};
+
+/**
+   \struct JwcTimes
+
+   \file JsonWebClient.h
+
+   \brief const JwcTimes& times = jsonWebClient.times();
+
+   Timestamps in microseconds (micros()) of the stages of the last
+   response and the server time it was sent at.
+
+   \note Should only be used as a part of TelegramBotClient
+   (https://github.com/schlingensiepen/TelegramBotClient)
+
+   \author Jörn Schlingensiepen <joern@schlingensiepen.com>
+
+*/
+struct JwcTimes
+{
+  /** Last request sent */
+  unsigned long Fired = 0;
+  /** First byte of the response received */
+  unsigned long FirstByte = 0;
+  /** Headers of the response parsed */
+  unsigned long Headers = 0;
+  /** Body parsed as JSON */
+  unsigned long Parsed = 0;
+  /** Date header of the response in seconds since 1970, 0 if not present */
+  unsigned long ServerDate = 0;
+};
+
+/**
+   \struct JwcBuffer
+
+   \file JsonWebClient.h
+
+   \brief static JwcBuffer<4096> pollBuffer;
+
+   Static storage of a JsonWebClient body, the size is known at link time.
+
+   \note Should only be used as a part of TelegramBotClient
+   (https://github.com/schlingensiepen/TelegramBotClient)
+
+   \author Jörn Schlingensiepen <joern@schlingensiepen.com>
+
+*/
+template <size_t SIZE>
+struct JwcBuffer
+{
+  /** Storage including the terminating zero */
+  char Storage[SIZE + 1];
+};
 
 /**
    \class JsonWebClient
@@ -121,7 +278,7 @@ static String toString(JwcClientState state)
    \file JsonWebClient.h
 
    \brief JSONWebClient (netClient, "www.example.com", 80,
-              CallBackObject, callBackMessage, callBackError);
+              callBackMessage, callBackError);
 
    This class implements a minimum http client to receive json data
    from a host. It uses an underlying implementation of Client interface
@@ -140,14 +297,101 @@ class JsonWebClient
     JwcClientState State = JwcClientState::Unconnected;
     /** Client used to access the net (depends on hardware) */
     Client* NetClient;
-    /** Host to connect to */
-    String Host;
+    /** Host to connect to, not copied */
+    const char* Host;
     /** Port to connect to */
     int Port;
-    /** Content length stored during header processing */
-    long ContentLength = JWC_BUFF_SIZE;
+    /** Content length stored during header processing, -1 if unknown */
+    long ContentLength = -1;
     /** Indicate if Http 200 Ok header was found */
     bool HttpStatusOk = false;
+    /** Http status code of the response, 0 before the status line */
+    int StatusCode = 0;
+    /** Value of Retry-After header in seconds, -1 if not present */
+    long RetryAfter = -1;
+    /** Indicates Transfer-Encoding: chunked */
+    bool Chunked = false;
+    /** Part of the chunked body read next */
+    JwcChunkState ChunkState = JwcChunkState::Size;
+    /** Number of data bytes left in the current chunk */
+    size_t ChunkRemaining = 0;
+    /**
+        \brief Reads body data available without waiting
+
+        \param [out] buffer Buffer receiving the data
+        \param [in] count Maximum number of bytes to read
+        \return Number of bytes read, -1 if a chunked body is malformed
+
+        \details Removes the framing of chunked bodies, reads the
+        framing following the data even if count is reached, so the
+        end of the body is noticed as soon as it is received.
+    */
+    int readBody(uint8_t* buffer, size_t count);
+    /**
+        \brief Checks a body of unknown length is complete
+
+        \return True if the last chunk of a chunked body was read
+    */
+    bool chunksDone() {
+      return Chunked && ChunkState == JwcChunkState::Done;
+    }
+    /** Indicates Connection: close */
+    bool ConnectionClose = false;
+    /** Value of Content-Encoding header */
+    JwcContentEncoding Encoding = JwcContentEncoding::Identity;
+    /** Header line read so far */
+    char Line[JWC_LINE_SIZE];
+    /** Number of characters in Line */
+    uint16_t LineLength = 0;
+    /**
+        \brief Process a complete header line
+
+        \return Nothing
+
+        \details Extracts status code and known headers from Line
+    */
+    void processHeaderLine();
+    /** Keep the connection open after a response, allows pipelining */
+    bool KeepAlive = false;
+    /** Number of requests sent without response received yet */
+    uint8_t Pending = 0;
+    /** Sink receiving the body of the next response instead of
+        parsing it as json, 0 to parse json */
+    Print* RawSink = 0;
+    /** Number of body bytes copied to RawSink */
+    size_t RawReceived = 0;
+    /** Callback called on copying data to RawSink */
+    JwcRawCallback callbackRaw;
+    /**
+        \brief Resets the values stored during header processing
+
+        \return Return nothing
+    */
+    void resetResponse();
+    /**
+        \brief Finishes a response
+
+        \return Return nothing
+
+        \details Switches to the next pipelined response or
+        to the idle state after a response was processed.
+    */
+    void finishResponse();
+    /**
+        \brief Drops the connection after an error
+
+        \return Return nothing
+
+        \details Stops the connection and reports pending requests
+        as lost by calling callbackError with JwcProcessError::ConnLost.
+    */
+    void dropConnection();
+    /**
+        \brief Handles a connection closed by the server
+
+        \return Return nothing
+    */
+    void closed();
     /**
         \brief Reconnects to host
 
@@ -156,49 +400,178 @@ class JsonWebClient
         \details Reconnects to host, skips open connection
     */
     void reConnect();
-    /** Object passed to the callbacks */
-    void* CallBackObject;
     /** Callback called on receiving a message / valid json data */
-    JWC_CALLBACK_MESSAGE_SIGNATURE;
+    JwcMessageCallback callbackSuccess;
     /** Callback called on error while receiving */
-    JWC_CALLBACK_ERROR_SIGNATURE;
+    JwcErrorCallback callbackError;
+    /** Callback called at the stages of a connection */
+    JwcConnectionHook callbackConnection;
+    /** Time in microseconds the last connect took */
+    unsigned long ConnectMicros = 0;
+    /** Number of connects */
+    unsigned long Connects = 0;
+    /** Cache of the address of Host, 0 to connect by name */
+    TBCAddressCache* AddressCache = 0;
+    /**
+        \brief Connects NetClient to Host
+
+        \return 1 on success as Client::connect()
+
+        \details Connects to the cached address of Host if known,
+        by name if not or if connecting to the address failed.
+    */
+    int connectHost();
+    /**
+        \brief Stops NetClient, calling callbackConnection before
+
+        \return Nothing
+    */
+    void closeClient();
     /**
         \brief Process a header
 
-        \return Returns true while headers found in underlying Client
+        \return Returns false when the empty line ending the headers was read
 
-        \details Read a header from NetClient and process it.
+        \details Reads header bytes available in NetClient into a line
+        buffer and processes each complete line, a partial line is kept
+        for the next call.
     */
     bool processHeader();
+    /** Maximum size of a body */
+    size_t BufferSize = JWC_BUFF_SIZE;
+    /** Storage of BufferSize + 1 bytes used for bodies, 0 to allocate them */
+    char* Buffer = 0;
+    /** Indicates Buffer holds a payload passed to callbackSuccess */
+    bool BufferBusy = false;
+    /** Buffer collecting the body of the response, 0 before the body */
+    char* Body = 0;
+    /** Size of Body without terminating zero */
+    size_t BodySize = 0;
+    /** Number of bytes stored in Body */
+    size_t BodyLength = 0;
+    /**
+        \brief Process the body
+
+        \return Returns true on success
+
+        \details Dispatches available body data to processRaw() or processBody()
+    */
+    bool processContent();
+    /**
+        \brief Collects the body
+
+        \return Returns true on success
+
+        \details Copies the body data already available in the underlying
+        Client to Body without waiting for more. Calls processJson()
+        when the body is complete. A body larger than the buffer is
+        read until the buffer is full, then reported as
+        JwcProcessError::MsgTooBig with its head, see bodyHead().
+    */
+    bool processBody();
+    /** Scan bodies by Scanner instead of parsing them */
+    bool AckFilter = false;
+    /** Scanner of acknowledgements, created by setAckFilter() */
+    JwcAckScanner* Scanner = 0;
+    /** Indicates Scanner was reset for the current response */
+    bool Scanning = false;
+    /** Number of body bytes scanned */
+    size_t Scanned = 0;
+    /**
+        \brief Scans the body for the acknowledgement fields
+
+        \return Returns true on success
+
+        \details Feeds the body data already available to Scanner
+        without storing it. Calls callbackSuccess with an invalid
+        JsonObject when the body is complete, the fields are provided
+        by ack(). Bodies of error responses are scanned as well before
+        callbackError is called.
+    */
+    bool scanBody();
     /**
         \brief Process JSON
 
         \return Returns true on success
 
-        \details Reads data from underlying Client and process it by ArduinoJSON
+        \details Parses the collected Body in place by ArduinoJSON
     */
     bool processJson();
+    /**
+        \brief Frees the body buffer
+
+        \return Nothing
+    */
+    void releaseBody();
+    /**
+        \brief Handles an error while processing a response
+
+        \param [in] err Error passed to callbackError
+        \return Nothing
+
+        \details The body received so far stays available by
+        bodyHead() until callbackError returns.
+    */
+    void fail(JwcProcessError err);
+    /**
+        \brief Process raw data
+
+        \return Returns true on success
+
+        \details Copies up to JWC_RAW_CHUNK bytes of the body from
+        the underlying Client to RawSink.
+    */
+    bool processRaw();
+    /**
+        \brief Inflates a compressed body
+
+        \return Returns true on success
+
+        \details Replaces Body by its decompressed content. The
+        decompressed body is written to the parse buffer, which serves
+        as window of the inflater, and has to fit into it.
+    */
+    bool inflateBody();
+    /** Ask the server for compressed responses */
+    bool Compression = false;
+    /** Number of bytes read from NetClient */
+    unsigned long BytesReceived = 0;
+    /** Time in microseconds spent on inflating and parsing bodies */
+    unsigned long ProcessMicros = 0;
+    /** Stages of the current response */
+    JwcTimes Times;
+    /**
+        \brief Finishes a raw response
+
+        \return Nothing
+
+        \details Releases RawSink and calls callbackSuccess with an
+        invalid JsonObject to indicate the body was received.
+    */
+    void finishRaw();
 
   public:
     /**
       Constructor, initializing all members
       \param netClient a object implementing Client interface to access the network.
       Using a Client implementing ssl feature will result in https otherwise http.
-      \param host Host to connect to
+      \param host Host to connect to, must outlive the client
       \param port Port to connect to
-      \param callBackObject Object passed to the callbacks, shall not be 0
-      \param JWC_CALLBACK_MESSAGE_SIGNATURE
+      \param callbackSuccess
       Callback called on receiving a message / valid json data
-      \param JWC_CALLBACK_ERROR_SIGNATURE
+      \param callbackError
       Callback called on error while receiving
     */
     JsonWebClient (
       Client* netClient,
-      String host,
+      const char* host,
       int port,
-      void* callBackObject,
-      JWC_CALLBACK_MESSAGE_SIGNATURE,
-      JWC_CALLBACK_ERROR_SIGNATURE);
+      JwcMessageCallback callbackSuccess,
+      JwcErrorCallback callbackError);
+    /**
+      Destructor
+    */
+    ~JsonWebClient();
     /**
         \brief Executes a list of commands
 
@@ -211,6 +584,33 @@ class JsonWebClient
         end of list. The commands shall follow the http protocol.
     */
     bool fire (String commands[], int count);
+    /**
+        \brief Starts a request
+
+        \return Return true if connected to the host
+
+        \details Reconnects to the host, afterwards the request can be
+        written to request() and shall be finished by endRequest().
+    */
+    bool beginRequest();
+    /**
+        \brief Output of the current request
+
+        \return The underlying client to write the request to
+
+        \details Gives access to the connection to write a request
+        started by beginRequest() without assembling it in memory.
+    */
+    Print& request();
+    /**
+        \brief Finishes a request
+
+        \return Return true on success
+
+        \details Flushes the request written to request() and
+        waits for the response of the server.
+    */
+    bool endRequest();
     /**
         \brief Current state of the client
 
@@ -222,12 +622,18 @@ class JsonWebClient
     /**
         \brief Method to poll client processing.
 
+        \param [in] budgetMicros Optional. Time in microseconds after which
+        processing stops, 0 to process all data available.
         \return True is an internal action was executed.
 
         \details Method to poll client processing,
-           shall be called in each main loop()
+           shall be called in each main loop(). It never waits for data,
+           headers and body are collected as they arrive and processing
+           continues with the next call. The time budget is checked after
+           each step (a header line, a chunk of the body); parsing the
+           complete body and the callbacks are a single step.
     */
-    bool loop();
+    bool loop(unsigned long budgetMicros = 0);
     /**
         \brief Stops the client
 
@@ -237,5 +643,214 @@ class JsonWebClient
           reset client state to JwcClientState::unconnected
     */
     bool stop();
+    /**
+        \brief Sets the buffer of bodies
+
+        \param [in] size Maximum size of a body, larger bodies are
+        reported as JwcProcessError::MsgTooBig
+        \param [in] storage Optional. Storage of size + 1 bytes used for all
+        bodies instead of allocating each, e.g. a JwcBuffer
+        \return Nothing
+
+        \details Defaults to JWC_BUFF_SIZE bytes allocated per body. Without
+        storage only the size of the body received is allocated. Decompressing
+        and parsing still allocate (inflate window, ArduinoJson buffer).
+    */
+    void setBuffer(size_t size, char* storage = 0);
+    /**
+        \brief Sets a static buffer of bodies
+
+        \param [in] buffer A JwcBuffer used for all bodies
+        \return Nothing
+    */
+    template <size_t SIZE> void setBuffer(JwcBuffer<SIZE>& buffer) {
+      setBuffer(SIZE, buffer.Storage);
+    }
+    /**
+        \brief Maximum size of a body
+
+        \return Size in bytes
+    */
+    size_t bufferSize();
+    /**
+        \brief Keeps the connection open after a response
+
+        \param [in] keepAlive True to reuse the connection
+
+        \return Nothing
+
+        \details In keep alive mode requests are written to the open
+        connection without waiting for outstanding responses (pipelining).
+        Responses are processed in the order of the requests. If the
+        connection is closed with requests pending, callbackError is
+        called with JwcProcessError::ConnLost. The requests shall ask the
+        server to keep the connection alive.
+    */
+    void setKeepAlive(bool keepAlive);
+    /**
+        \brief Number of pending requests
+
+        \return Number of requests sent without response received yet
+    */
+    uint8_t pending();
+    /**
+        \brief Receives the body of the next response as raw data
+
+        \param [in] sink Print the body is copied to
+        \param [in] callbackRaw
+        Callback called after each chunk copied with the number of
+        bytes received so far and the content length (-1 if unknown)
+        \return Nothing
+
+        \details The body of the next response is not parsed as json but
+        copied in chunks of JWC_RAW_CHUNK bytes to sink. On completion
+        callbackSuccess is called with an invalid JsonObject.
+    */
+    void setRawSink(Print* sink, JwcRawCallback callbackRaw);
+    /**
+        \brief Scans responses for acknowledgement fields only
+
+        \param [in] ackFilter True to scan, false to parse bodies as json
+
+        \return Nothing
+
+        \details Applies to the bodies of all following responses. A
+        scanned body is neither stored nor parsed, only ok,
+        result.message_id, error_code and description are kept and
+        provided by ack(), callbackSuccess is called with an invalid
+        JsonObject. Memory and time needed do not depend on the size of
+        the body. Compressed bodies are still parsed.
+    */
+    void setAckFilter(bool ackFilter);
+    /**
+        \brief Sets a hook called at the stages of a connection
+
+        \param [in] callbackConnection
+        Callback called before connecting, after connecting successfully
+        and before stopping NetClient with the NetClient
+
+        \return Nothing
+
+        \details Allows to prepare and inspect the client, e.g. to resume
+        TLS sessions by a TBCSessionCache.
+    */
+    void setConnectionHook(JwcConnectionHook callbackConnection);
+    /**
+        \brief Sets a cache of the address of the host
+
+        \param [in] cache Cache shared with other clients, 0 to connect by name
+
+        \return Nothing
+
+        \details Connects by address and asks the resolver only when the
+        address expired or connecting failed. Connecting by address
+        does not tell the client the name of the host: TBCPosixClient
+        sends the name set by setHostname() as SNI, BearSSL on ESP8266
+        sends no SNI and checks no name, thus use it with a
+        fingerprint there. The Host header is not affected.
+    */
+    void setAddressCache(TBCAddressCache* cache);
+    /**
+        \brief Duration of the last connect
+
+        \return Time in microseconds of connecting including the TLS handshake
+    */
+    unsigned long connectMicros();
+    /**
+        \brief Number of connects
+
+        \return Number of connects, successful or not
+    */
+    unsigned long connects();
+    /**
+        \brief Acknowledgement fields of the last scanned response
+
+        \return The fields, valid in callbacks
+    */
+    const JwcAck& ack();
+    /**
+        \brief Start of the body of a failed response
+
+        \return The body received so far, zero terminated, empty if none
+
+        \details Valid in callbackError only. With
+        JwcProcessError::MsgTooBig it holds up to the buffer size
+        bytes of the body, which is read without waiting for the rest.
+    */
+    const char* bodyHead();
+    /**
+        \brief Http status code of the current response
+
+        \return The status code, 0 if no status line was received
+
+        \details Valid in callbacks, e.g. 429 if too many requests were sent.
+    */
+    int statusCode();
+    /**
+        \brief Retry-After header of the current response
+
+        \return Seconds to wait before the next request, -1 if not present
+    */
+    long retryAfter();
+    /**
+        \brief Transfer-Encoding header of the current response
+
+        \return True if the body is sent in chunks
+    */
+    bool chunked();
+    /**
+        \brief Connection header of the current response
+
+        \return True if the server closes the connection after the response
+    */
+    bool connectionClose();
+    /**
+        \brief Content-Encoding header of the current response
+
+        \return The encoding of the body
+    */
+    JwcContentEncoding contentEncoding();
+    /**
+        \brief Asks the server for compressed responses
+
+        \param [in] compression True to accept gzip and deflate
+
+        \return Nothing
+
+        \details Compressed json bodies are inflated transparently,
+        the compressed body as well as the decompressed body have to fit
+        into the buffer size (see setBuffer()). The compressed body is
+        allocated beside the buffer until it is inflated into it.
+        Bodies copied to a raw sink are not inflated,
+        requests using setRawSink() shall not accept compression.
+    */
+    void setCompression(bool compression);
+    /**
+        \brief Writes the Accept-Encoding header
+
+        \return Nothing
+
+        \details Writes the header to request() if compression is
+        enabled, called by fire() before the empty line ending the headers.
+    */
+    void acceptEncoding();
+    /**
+        \brief Number of bytes received
+
+        \return Number of bytes (headers and bodies) read from the network
+    */
+    unsigned long bytesReceived();
+    /**
+        \brief Time spent processing bodies
+
+        \return Time in microseconds spent on inflating and parsing bodies
+    */
+    unsigned long processMicros();
+    /**
+        \brief Timestamps of the current response
+
+        \return The timestamps, valid in callbacks
+    */
+    const JwcTimes& times();
 };
-#endif
+#endif
@@ -0,0 +1,202 @@
+/**
+    \file JwcAckScanner.cpp
+    \brief Implementation of a streaming scanner extracting the
+           acknowledgement fields of a Telegram response.
+
+    Part of TelegramBotClient (https://github.com/schlingensiepen/TelegramBotClient)
+    Jörn Schlingensiepen <joern@schlingensiepen.com>
+*/
+
+#include "JwcAckScanner.h"
+
+/** Members and fields recognized */
+#define JWC_ACK_NONE 0
+#define JWC_ACK_OK 1
+#define JWC_ACK_RESULT 2
+#define JWC_ACK_ERROR_CODE 3
+#define JWC_ACK_DESCRIPTION_FIELD 4
+#define JWC_ACK_MESSAGE_ID 5
+
+JwcAckScanner::JwcAckScanner()
+{
+  reset();
+}
+
+void JwcAckScanner::reset()
+{
+  memset(&Ack, 0, sizeof(Ack));
+  Depth = 0;
+  Objects = 0;
+  ExpectKey = false;
+  InString = false;
+  InKey = false;
+  Escape = false;
+  SkipHex = 0;
+  InLiteral = false;
+  Member = JWC_ACK_NONE;
+  Target = JWC_ACK_NONE;
+  TokenLength = 0;
+  DescriptionLength = 0;
+}
+
+bool JwcAckScanner::inObject()
+{
+  if (Depth == 0 || Depth > 32) return Depth > 32;
+  return (Objects >> (Depth - 1)) & 1;
+}
+
+void JwcAckScanner::addToken(char c)
+{
+  if (TokenLength < JWC_ACK_TOKEN - 1) Token[TokenLength] = c;
+  if (TokenLength < JWC_ACK_TOKEN) TokenLength++;
+}
+
+void JwcAckScanner::endKey()
+{
+  Target = JWC_ACK_NONE;
+  if (TokenLength >= JWC_ACK_TOKEN) return;
+  Token[TokenLength] = 0;
+  if (Depth == 1)
+  {
+    if (strcmp_P(Token, PSTR("ok")) == 0) Member = JWC_ACK_OK;
+    else if (strcmp_P(Token, PSTR("result")) == 0) Member = JWC_ACK_RESULT;
+    else if (strcmp_P(Token, PSTR("error_code")) == 0) Member = JWC_ACK_ERROR_CODE;
+    else if (strcmp_P(Token, PSTR("description")) == 0) Member = JWC_ACK_DESCRIPTION_FIELD;
+    else Member = JWC_ACK_NONE;
+    if (Member != JWC_ACK_RESULT) Target = Member;
+  }
+  else if (Depth == 2 && Member == JWC_ACK_RESULT
+           && strcmp_P(Token, PSTR("message_id")) == 0)
+  {
+    Target = JWC_ACK_MESSAGE_ID;
+  }
+}
+
+void JwcAckScanner::endLiteral()
+{
+  InLiteral = false;
+  if (TokenLength >= JWC_ACK_TOKEN) TokenLength = JWC_ACK_TOKEN - 1;
+  Token[TokenLength] = 0;
+  switch (Target)
+  {
+    case JWC_ACK_OK:
+      Ack.Ok = strcmp_P(Token, PSTR("true")) == 0;
+      break;
+    case JWC_ACK_ERROR_CODE:
+      Ack.ErrorCode = atoi(Token);
+      break;
+    case JWC_ACK_MESSAGE_ID:
+      Ack.MessageId = atol(Token);
+      break;
+    default:
+      break;
+  }
+  Target = JWC_ACK_NONE;
+}
+
+void JwcAckScanner::feedString(char c)
+{
+  if (Escape)
+  {
+    Escape = false;
+    switch (c)
+    {
+      case 'n': c = '\n'; break;
+      case 't': c = '\t'; break;
+      case 'r': c = '\r'; break;
+      case 'b': c = '\b'; break;
+      case 'f': c = '\f'; break;
+      case 'u':
+        // characters beyond ascii are not decoded
+        SkipHex = 4;
+        c = '?';
+        break;
+      default: break;
+    }
+  }
+  else if (SkipHex > 0)
+  {
+    SkipHex--;
+    return;
+  }
+  else if (c == '\\')
+  {
+    Escape = true;
+    return;
+  }
+  else if (c == '"')
+  {
+    InString = false;
+    if (InKey) endKey();
+    else Target = JWC_ACK_NONE;
+    return;
+  }
+  if (InKey) addToken(c);
+  else if (Target == JWC_ACK_DESCRIPTION_FIELD && DescriptionLength < JWC_ACK_DESCRIPTION)
+    Ack.Description[DescriptionLength++] = c;
+}
+
+void JwcAckScanner::feed(const uint8_t* data, size_t length)
+{
+  for (size_t i = 0; i < length; i++)
+  {
+    char c = (char) data[i];
+    if (InString)
+    {
+      feedString(c);
+      continue;
+    }
+    if (InLiteral)
+    {
+      if (isalnum(c) || c == '.' || c == '-' || c == '+')
+      {
+        addToken(c);
+        continue;
+      }
+      endLiteral();
+    }
+    switch (c)
+    {
+      case '{':
+      case '[':
+        if (Depth < 32)
+        {
+          if (c == '{') Objects |= (1UL << Depth);
+          else Objects &= ~(1UL << Depth);
+        }
+        if (Depth < 255) Depth++;
+        ExpectKey = (c == '{');
+        Target = JWC_ACK_NONE;
+        break;
+      case '}':
+      case ']':
+        if (Depth == 0) break;
+        Depth--;
+        if (Depth == 1) Member = JWC_ACK_NONE;
+        if (Depth == 0) Ack.Complete = true;
+        ExpectKey = false;
+        break;
+      case ',':
+        ExpectKey = inObject();
+        break;
+      case ':':
+        ExpectKey = false;
+        break;
+      case '"':
+        InString = true;
+        InKey = ExpectKey;
+        TokenLength = 0;
+        break;
+      case ' ':
+      case '\t':
+      case '\r':
+      case '\n':
+        break;
+      default:
+        InLiteral = true;
+        TokenLength = 0;
+        addToken(c);
+        break;
+    }
+  }
+}
@@ -0,0 +1,157 @@
+/**
+    \file JwcAckScanner.h
+    \brief Header of a streaming scanner extracting the acknowledgement
+           fields of a Telegram response without building a JSON tree.
+
+    Part of TelegramBotClient (https://github.com/schlingensiepen/TelegramBotClient)
+    Jörn Schlingensiepen <joern@schlingensiepen.com>
+*/
+#pragma once
+#ifndef JwcAckScanner_h
+#define JwcAckScanner_h
+
+#include "TBCDebug.h"
+#include "Arduino.h"
+
+/** Size of the description kept, longer descriptions are truncated */
+#ifndef JWC_ACK_DESCRIPTION
+#define JWC_ACK_DESCRIPTION 64
+#endif
+
+/** Size of the buffer holding a key or a number, longer ones never match */
+#define JWC_ACK_TOKEN 16
+
+/**
+   \struct JwcAck
+
+   \file JwcAckScanner.h
+
+   \brief const JwcAck& ack = jsonWebClient.ack();
+
+   Fields of a Telegram response acknowledging a request.
+
+   \note Should only be used as a part of TelegramBotClient
+   (https://github.com/schlingensiepen/TelegramBotClient)
+
+   \author Jörn Schlingensiepen <joern@schlingensiepen.com>
+
+*/
+struct JwcAck
+{
+  /** Indicates the whole object was scanned */
+  bool Complete;
+  /** Value of ok */
+  bool Ok;
+  /** Value of result.message_id, 0 if not present */
+  long MessageId;
+  /** Value of error_code, 0 if not present */
+  int ErrorCode;
+  /** Value of description, empty if not present */
+  char Description[JWC_ACK_DESCRIPTION + 1];
+};
+
+/**
+   \class JwcAckScanner
+
+   \file JwcAckScanner.h
+
+   \brief JwcAckScanner scanner; scanner.feed(data, length);
+
+   Scans a JSON object byte by byte, possibly split in any number of
+   chunks, and keeps only ok, result.message_id, error_code and
+   description. Memory and time are constant per byte, whatever the
+   size of the echoed message is. The JSON is expected to be valid,
+   invalid JSON is not detected but never leaves Complete set.
+
+   \note Should only be used as a part of TelegramBotClient
+   (https://github.com/schlingensiepen/TelegramBotClient)
+
+   \author Jörn Schlingensiepen <joern@schlingensiepen.com>
+
+*/
+class JwcAckScanner
+{
+  private:
+    /** Fields found so far */
+    JwcAck Ack;
+    /** Nesting level, 0 outside of the object */
+    uint8_t Depth;
+    /** Bit n is set if level n + 1 is an object, not an array */
+    uint32_t Objects;
+    /** Indicates the next string is a key */
+    bool ExpectKey;
+    /** Indicates a string is scanned */
+    bool InString;
+    /** Indicates the string scanned is a key */
+    bool InKey;
+    /** Indicates the last character was a backslash */
+    bool Escape;
+    /** Number of hex digits of a \\u escape left to skip */
+    uint8_t SkipHex;
+    /** Indicates a number or literal is scanned */
+    bool InLiteral;
+    /** Member of the object at level 1 scanned */
+    uint8_t Member;
+    /** Field the value scanned is stored to */
+    uint8_t Target;
+    /** Key or literal scanned */
+    char Token[JWC_ACK_TOKEN];
+    /** Number of characters in Token */
+    uint8_t TokenLength;
+    /** Number of characters in Ack.Description */
+    uint8_t DescriptionLength;
+
+    /**
+        \brief Indicates the current level is an object
+
+        \return True in an object, false in an array
+    */
+    bool inObject();
+    /**
+        \brief Adds a character to Token, characters beyond its size are dropped
+
+        \param [in] c The character
+    */
+    void addToken(char c);
+    /**
+        \brief Matches a key just scanned to the fields kept
+    */
+    void endKey();
+    /**
+        \brief Stores a number or literal just scanned
+    */
+    void endLiteral();
+    /**
+        \brief Scans a character of a string
+
+        \param [in] c The character
+    */
+    void feedString(char c);
+
+  public:
+    /**
+        \brief Constructor
+    */
+    JwcAckScanner();
+    /**
+        \brief Starts scanning a new object
+    */
+    void reset();
+    /**
+        \brief Scans a part of the object
+
+        \param [in] data The bytes
+        \param [in] length Number of bytes
+    */
+    void feed(const uint8_t* data, size_t length);
+    /**
+        \brief Fields found
+
+        \return The fields, valid if Complete is set
+    */
+    const JwcAck& ack() {
+      return Ack;
+    }
+};
+
+#endif
@@ -0,0 +1,280 @@
+/**
+    \file JwcInflater.cpp
+    \brief Implementation of a small inflater decompressing gzip and deflate
+           encoded http bodies for JsonWebClient.
+           Follows the structure of puff.c by Mark Adler (zlib license).
+
+    Part of TelegramBotClient (https://github.com/schlingensiepen/TelegramBotClient)
+    Jörn Schlingensiepen <joern@schlingensiepen.com>
+*/
+
+#include "JwcInflater.h"
+
+/** Base lengths of length codes 257..285 */
+static const uint16_t LengthBase[29] PROGMEM = {
+  3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+  35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+/** Extra bits of length codes 257..285 */
+static const uint8_t LengthExtra[29] PROGMEM = {
+  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+  3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+/** Base distances of distance codes 0..29 */
+static const uint16_t DistBase[30] PROGMEM = {
+  1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+  257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+  8193, 12289, 16385, 24577
+};
+/** Extra bits of distance codes 0..29 */
+static const uint8_t DistExtra[30] PROGMEM = {
+  0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+  7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+/** Order of code length code lengths */
+static const uint8_t CodeOrder[19] PROGMEM = {
+  16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+uint16_t JwcInflater::bits(uint8_t count)
+{
+  while (BitCount < count)
+  {
+    if (InPos >= InLength)
+    {
+      Error = true;
+      return 0;
+    }
+    BitBuf |= (uint32_t) In[InPos++] << BitCount;
+    BitCount += 8;
+  }
+  uint16_t value = BitBuf & ((1UL << count) - 1);
+  BitBuf >>= count;
+  BitCount -= count;
+  return value;
+}
+
+void JwcInflater::output(uint8_t value)
+{
+  if (OutCount >= OutSize)
+  {
+    Overflow = true;
+    return;
+  }
+  Out[OutCount++] = value;
+}
+
+int JwcInflater::decode(JwcHuffman& code)
+{
+  int value = 0;
+  int first = 0;
+  int index = 0;
+  for (uint8_t length = 1; length < 16; length++)
+  {
+    value |= bits(1);
+    if (Error) return -1;
+    int count = code.Count[length];
+    if (value - count < first) return code.Symbol[index + (value - first)];
+    index += count;
+    first += count;
+    first <<= 1;
+    value <<= 1;
+  }
+  return -1;
+}
+
+int JwcInflater::construct(JwcHuffman& code, const uint8_t* lengths, uint16_t count)
+{
+  uint16_t offsets[16];
+  for (uint8_t length = 0; length < 16; length++) code.Count[length] = 0;
+  for (uint16_t symbol = 0; symbol < count; symbol++) code.Count[lengths[symbol]]++;
+  if (code.Count[0] == count) return 0;
+  int left = 1;
+  for (uint8_t length = 1; length < 16; length++)
+  {
+    left <<= 1;
+    left -= code.Count[length];
+    if (left < 0) return left; // over subscribed
+  }
+  offsets[1] = 0;
+  for (uint8_t length = 1; length < 15; length++)
+    offsets[length + 1] = offsets[length] + code.Count[length];
+  for (uint16_t symbol = 0; symbol < count; symbol++)
+  {
+    if (lengths[symbol] != 0) code.Symbol[offsets[lengths[symbol]]++] = symbol;
+  }
+  return left; // > 0 if incomplete
+}
+
+bool JwcInflater::stored()
+{
+  BitBuf = 0;
+  BitCount = 0;
+  if (InPos + 4 > InLength) return false;
+  uint16_t length = In[InPos] | (In[InPos + 1] << 8);
+  uint16_t check = In[InPos + 2] | (In[InPos + 3] << 8);
+  InPos += 4;
+  if (length != (uint16_t) ~check) return false;
+  if (InPos + length > InLength) return false;
+  while (length-- > 0) output(In[InPos++]);
+  return !Overflow;
+}
+
+bool JwcInflater::codes()
+{
+  for (;;)
+  {
+    int symbol = decode(LenCode);
+    if (symbol < 0) return false;
+    if (symbol < 256)
+    {
+      output(symbol);
+      if (Overflow) return false;
+      continue;
+    }
+    if (symbol == 256) return true;
+    symbol -= 257;
+    if (symbol >= 29) return false;
+    uint16_t length = pgm_read_word(&LengthBase[symbol]) + bits(pgm_read_byte(&LengthExtra[symbol]));
+    symbol = decode(DistCode);
+    if (symbol < 0 || symbol >= 30) return false;
+    size_t distance = pgm_read_word(&DistBase[symbol]) + bits(pgm_read_byte(&DistExtra[symbol]));
+    if (Error) return false;
+    if (distance > OutCount)
+    {
+      DOUTKV("Distance too far back", distance);
+      return false;
+    }
+    while (length-- > 0) output(Out[OutCount - distance]);
+    if (Overflow) return false;
+  }
+}
+
+bool JwcInflater::fixed()
+{
+  uint8_t* lengths = Lengths;
+  uint16_t symbol = 0;
+  for (; symbol < 144; symbol++) lengths[symbol] = 8;
+  for (; symbol < 256; symbol++) lengths[symbol] = 9;
+  for (; symbol < 280; symbol++) lengths[symbol] = 7;
+  for (; symbol < 288; symbol++) lengths[symbol] = 8;
+  construct(LenCode, lengths, 288);
+  for (symbol = 0; symbol < 30; symbol++) lengths[symbol] = 5;
+  construct(DistCode, lengths, 30);
+  return codes();
+}
+
+bool JwcInflater::dynamic()
+{
+  uint8_t* lengths = Lengths;
+  uint16_t lengthCount = bits(5) + 257;
+  uint16_t distCount = bits(5) + 1;
+  uint16_t codeCount = bits(4) + 4;
+  if (Error || lengthCount > 286 || distCount > 30) return false;
+
+  uint16_t index = 0;
+  for (; index < codeCount; index++) lengths[pgm_read_byte(&CodeOrder[index])] = bits(3);
+  for (; index < 19; index++) lengths[pgm_read_byte(&CodeOrder[index])] = 0;
+  if (Error || construct(LenCode, lengths, 19) != 0) return false;
+
+  index = 0;
+  while (index < lengthCount + distCount)
+  {
+    int symbol = decode(LenCode);
+    if (symbol < 0) return false;
+    if (symbol < 16)
+    {
+      lengths[index++] = symbol;
+      continue;
+    }
+    uint8_t length = 0;
+    uint16_t repeat;
+    if (symbol == 16)
+    {
+      if (index == 0) return false;
+      length = lengths[index - 1];
+      repeat = 3 + bits(2);
+    }
+    else if (symbol == 17) repeat = 3 + bits(3);
+    else repeat = 11 + bits(7);
+    if (Error || index + repeat > lengthCount + distCount) return false;
+    while (repeat-- > 0) lengths[index++] = length;
+  }
+  if (lengths[256] == 0) return false;
+
+  // incomplete codes are only allowed for a single length
+  int left = construct(LenCode, lengths, lengthCount);
+  if (left < 0 || (left > 0 && lengthCount - LenCode.Count[0] != 1)) return false;
+  left = construct(DistCode, lengths + lengthCount, distCount);
+  if (left < 0 || (left > 0 && distCount - DistCode.Count[0] != 1)) return false;
+  return codes();
+}
+
+bool JwcInflater::skipHeader()
+{
+  if (InLength >= 10 && In[0] == 0x1f && In[1] == 0x8b && In[2] == 8)
+  {
+    // gzip
+    uint8_t flags = In[3];
+    InPos = 10;
+    if (flags & 0x04)
+    {
+      if (InPos + 2 > InLength) return false;
+      InPos += 2 + (In[InPos] | (In[InPos + 1] << 8));
+    }
+    if (flags & 0x08) while (InPos < InLength && In[InPos++] != 0);
+    if (flags & 0x10) while (InPos < InLength && In[InPos++] != 0);
+    if (flags & 0x02) InPos += 2;
+    return InPos < InLength;
+  }
+  if (InLength >= 2 && (In[0] & 0x0f) == 8 && ((In[0] << 8) | In[1]) % 31 == 0)
+  {
+    // zlib, preset dictionaries are not supported
+    if (In[1] & 0x20) return false;
+    InPos = 2;
+  }
+  return true;
+}
+
+long JwcInflater::inflate(const uint8_t* in, size_t length)
+{
+  In = in;
+  InLength = length;
+  InPos = 0;
+  BitBuf = 0;
+  BitCount = 0;
+  Error = false;
+  Overflow = false;
+  OutCount = 0;
+  if (!skipHeader()) return -1;
+
+  bool last;
+  do
+  {
+    last = bits(1);
+    uint8_t type = bits(2);
+    if (Error) return -1;
+    bool ok;
+    switch (type)
+    {
+      case 0: ok = stored(); break;
+      case 1: ok = fixed(); break;
+      case 2: ok = dynamic(); break;
+      default: ok = false;
+    }
+    if (!ok || Error)
+    {
+      if (Overflow)
+      {
+        DOUT("Inflated data too big");
+      }
+      else
+      {
+        DOUT("Inflate failed");
+      }
+      return -1;
+    }
+  } while (!last);
+  DOUTKV("Inflated", OutCount);
+  return OutCount;
+}
@@ -0,0 +1,127 @@
+/**
+    \file JwcInflater.h
+    \brief Header of a small inflater decompressing gzip and deflate
+           encoded http bodies for JsonWebClient.
+
+    Part of TelegramBotClient (https://github.com/schlingensiepen/TelegramBotClient)
+    Jörn Schlingensiepen <joern@schlingensiepen.com>
+*/
+#pragma once
+#ifndef JwcInflater_h
+#define JwcInflater_h
+
+#include "TBCDebug.h"
+#include "Arduino.h"
+
+/**
+   \struct JwcHuffman
+
+   \file JwcInflater.h
+
+   \brief Canonical huffman code used by JwcInflater
+
+   \note Should only be used as a part of TelegramBotClient
+   (https://github.com/schlingensiepen/TelegramBotClient)
+
+   \author Jörn Schlingensiepen <joern@schlingensiepen.com>
+
+*/
+struct JwcHuffman
+{
+  /** Number of symbols of each code length */
+  uint16_t Count[16];
+  /** Symbols ordered by code */
+  uint16_t Symbol[288];
+};
+
+/**
+   \class JwcInflater
+
+   \file JwcInflater.h
+
+   \brief JwcInflater* inflater = new JwcInflater(buffer, sizeof(buffer));
+
+   Decompresses gzip (RFC 1952), zlib (RFC 1950) and raw deflate
+   (RFC 1951) data held in memory into a buffer. The buffer is the
+   window of back references as well, so they reach as far as the
+   output, up to the 32 KB deflate allows. The code tables take about
+   1.6 KB, allocate the inflater on the heap where the stack is small.
+   Checksums are not verified, the transport (TLS) is expected to
+   ensure integrity.
+
+   \note Should only be used as a part of TelegramBotClient
+   (https://github.com/schlingensiepen/TelegramBotClient)
+
+   \author Jörn Schlingensiepen <joern@schlingensiepen.com>
+
+*/
+class JwcInflater
+{
+  private:
+    /** Buffer the output is written to */
+    uint8_t* Out;
+    /** Size of Out */
+    size_t OutSize;
+    /** Compressed input */
+    const uint8_t* In;
+    /** Length of In */
+    size_t InLength;
+    /** Position of the next byte in In */
+    size_t InPos;
+    /** Bit buffer */
+    uint32_t BitBuf;
+    /** Number of bits in BitBuf */
+    uint8_t BitCount;
+    /** Indicates an error while reading input */
+    bool Error;
+    /** Indicates the output did not fit into Out */
+    bool Overflow;
+    /** Number of bytes written to Out */
+    size_t OutCount;
+    /** Code of literals and lengths */
+    JwcHuffman LenCode;
+    /** Code of distances */
+    JwcHuffman DistCode;
+    /** Code lengths of the block read */
+    uint8_t Lengths[320];
+
+    uint16_t bits(uint8_t count);
+    void output(uint8_t value);
+    int decode(JwcHuffman& code);
+    int construct(JwcHuffman& code, const uint8_t* lengths, uint16_t count);
+    bool stored();
+    bool codes();
+    bool fixed();
+    bool dynamic();
+    bool skipHeader();
+  public:
+    /**
+        \brief Constructor
+        \param out Buffer the output is written to
+        \param outSize Size of out
+    */
+    JwcInflater(uint8_t* out, size_t outSize)
+      : Out(out), OutSize(outSize) {};
+    /**
+        \brief Decompresses data
+
+        \param [in] in Compressed data
+        \param [in] length Length of the compressed data
+        \return Number of bytes written to the buffer, -1 on error
+
+        \details Detects gzip and zlib headers, other data is
+        decoded as raw deflate stream. If the output does not fit,
+        the buffer holds its start and overflow() returns true.
+    */
+    long inflate(const uint8_t* in, size_t length);
+    /**
+        \brief Indicates the output of the last inflate() did not fit
+
+        \return True if the output was truncated
+    */
+    bool overflow() {
+      return Overflow;
+    }
+};
+
+#endif
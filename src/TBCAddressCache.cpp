@@ -0,0 +1,103 @@
+/**
+    \file TBCAddressCache.cpp
+    \brief Implementation of a cache of resolved host addresses.
+
+    Part of TelegramBotClient (https://github.com/schlingensiepen/TelegramBotClient)
+    Jörn Schlingensiepen <joern@schlingensiepen.com>
+*/
+
+#include "TBCAddressCache.h"
+
+#if defined(ESP8266)
+#include <ESP8266WiFi.h>
+#elif defined(ESP32)
+#include <WiFi.h>
+#elif defined(__unix__)
+#include <netdb.h>
+#include <netinet/in.h>
+#endif
+
+TBCAddressCache::TBCAddressCache(unsigned long ttl)
+{
+  DOUT("New TBCAddressCache");
+  this->Ttl = ttl;
+}
+
+TBCAddressEntry* TBCAddressCache::find(const char* host)
+{
+  for (uint8_t i = 0; i < TBC_ADDRESS_HOSTS; i++)
+  {
+    if (Entries[i].Host != 0
+        && (Entries[i].Host == host || strcmp(Entries[i].Host, host) == 0))
+      return &Entries[i];
+  }
+  return 0;
+}
+
+bool TBCAddressCache::query(const char* host, IPAddress& address)
+{
+  Queries++;
+#if defined(ESP8266) || defined(ESP32)
+  return WiFi.hostByName(host, address) == 1;
+#elif defined(__unix__)
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  // IPAddress holds IPv4 addresses only
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  struct addrinfo* addresses = 0;
+  if (getaddrinfo(host, 0, &hints, &addresses) != 0) return false;
+  const uint8_t* bytes = (const uint8_t*) &((struct sockaddr_in*) addresses->ai_addr)->sin_addr;
+  address = IPAddress(bytes[0], bytes[1], bytes[2], bytes[3]);
+  freeaddrinfo(addresses);
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool TBCAddressCache::lookup(const char* host, IPAddress& address)
+{
+  TBCAddressEntry* entry = find(host);
+  if (entry != 0 && !entry->Expired && (millis() - entry->Resolved) < Ttl)
+  {
+    address = entry->Address;
+    return true;
+  }
+  IPAddress resolved;
+  if (!query(host, resolved))
+  {
+    DOUTKV("Host not resolved", host);
+    if (entry == 0) return false;
+    // better an old address than none, it is resolved again next time
+    address = entry->Address;
+    return true;
+  }
+  if (entry == 0)
+  {
+    // replace the entry resolved longest ago
+    entry = &Entries[0];
+    for (uint8_t i = 0; i < TBC_ADDRESS_HOSTS; i++)
+    {
+      if (Entries[i].Host == 0)
+      {
+        entry = &Entries[i];
+        break;
+      }
+      if ((long) (Entries[i].Resolved - entry->Resolved) < 0) entry = &Entries[i];
+    }
+    entry->Host = host;
+  }
+  entry->Address = resolved;
+  entry->Resolved = millis();
+  entry->Expired = false;
+  address = resolved;
+  DOUTKV("Host resolved", host);
+  return true;
+}
+
+void TBCAddressCache::invalidate(const char* host)
+{
+  TBCAddressEntry* entry = find(host);
+  if (entry != 0) entry->Expired = true;
+}
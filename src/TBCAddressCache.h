@@ -0,0 +1,129 @@
+/**
+    \file TBCAddressCache.h
+    \brief Header of a cache of resolved host addresses shared by the
+           connections of TelegramBotClient.
+
+    Part of TelegramBotClient (https://github.com/schlingensiepen/TelegramBotClient)
+    Jörn Schlingensiepen <joern@schlingensiepen.com>
+*/
+#pragma once
+#ifndef TBCAddressCache_h
+#define TBCAddressCache_h
+
+#include "TBCDebug.h"
+#include "Arduino.h"
+#include <Client.h>
+
+/** Time in milliseconds a resolved address is used */
+#ifndef TBC_ADDRESS_TTL
+#define TBC_ADDRESS_TTL 300000
+#endif
+
+/** Number of hosts kept */
+#ifndef TBC_ADDRESS_HOSTS
+#define TBC_ADDRESS_HOSTS 2
+#endif
+
+/**
+   \struct TBCAddressEntry
+
+   \file TBCAddressCache.h
+
+   \brief Address of a host kept by TBCAddressCache
+
+   \note Should only be used as a part of TelegramBotClient
+   (https://github.com/schlingensiepen/TelegramBotClient)
+
+   \author Jörn Schlingensiepen <joern@schlingensiepen.com>
+
+*/
+struct TBCAddressEntry
+{
+  /** Name of the host, 0 if the entry is unused */
+  const char* Host = 0;
+  /** Resolved address */
+  IPAddress Address;
+  /** millis() when the address was resolved */
+  unsigned long Resolved = 0;
+  /** Indicates the address has to be resolved again */
+  bool Expired = true;
+};
+
+/**
+   \class TBCAddressCache
+
+   \file TBCAddressCache.h
+
+   \brief TBCAddressCache addresses; client.setAddressCache(&addresses);
+
+   Keeps the addresses of hosts for a time to live, so reconnects do
+   not ask the resolver each time. An address is resolved again when
+   it expired or connecting to it failed. If the resolver fails, the
+   expired address is still used. Resolves by WiFi.hostByName() on
+   ESP8266 and ESP32 and by getaddrinfo() on Linux, on other platforms
+   nothing is resolved and clients connect by name as before.
+
+   \note Should only be used as a part of TelegramBotClient
+   (https://github.com/schlingensiepen/TelegramBotClient)
+
+   \author Jörn Schlingensiepen <joern@schlingensiepen.com>
+
+*/
+class TBCAddressCache
+{
+  private:
+    /** Hosts kept */
+    TBCAddressEntry Entries[TBC_ADDRESS_HOSTS];
+    /** Time in milliseconds a resolved address is used */
+    unsigned long Ttl;
+    /** Number of queries sent to the resolver */
+    unsigned long Queries = 0;
+    /**
+        \brief Finds the entry of a host
+
+        \param [in] host Name of the host
+        \return The entry, 0 if the host is not kept
+    */
+    TBCAddressEntry* find(const char* host);
+    /**
+        \brief Asks the resolver of the platform
+
+        \param [in] host Name of the host
+        \param [out] address Address of the host
+        \return True if the host was resolved
+    */
+    bool query(const char* host, IPAddress& address);
+
+  public:
+    /**
+        \brief Constructor
+
+        \param [in] ttl Time in milliseconds a resolved address is used
+    */
+    TBCAddressCache(unsigned long ttl = TBC_ADDRESS_TTL);
+    /**
+        \brief Address of a host
+
+        \param [in] host Name of the host, has to outlive the cache
+        \param [out] address Address of the host
+        \return True if an address is known
+    */
+    bool lookup(const char* host, IPAddress& address);
+    /**
+        \brief Resolves a host again at the next lookup
+
+        \param [in] host Name of the host
+        \return Nothing
+    */
+    void invalidate(const char* host);
+    /**
+        \brief Number of queries sent to the resolver
+
+        \return Number of queries
+    */
+    unsigned long queries() {
+      return Queries;
+    }
+};
+
+#endif
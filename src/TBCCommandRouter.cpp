@@ -0,0 +1,170 @@
+/**
+    \file TBCCommandRouter.cpp
+    \brief Implementation of a router dispatching bot commands
+           to handlers registered per command.
+
+    Part of TelegramBotClient (https://github.com/schlingensiepen/TelegramBotClient)
+    Jörn Schlingensiepen <joern@schlingensiepen.com>
+*/
+
+#include "TBCCommandRouter.h"
+#include "TelegramBotClient.h"
+
+/** Number of seeds tried for each table size */
+#define TBC_COMMAND_SEEDS 256
+
+/** Marks an empty slot of the hash table */
+#define TBC_COMMAND_EMPTY 0xff
+
+static bool isSpace(char c)
+{
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+void TBCCommandArgs::split(const char* text)
+{
+  Count = 0;
+  while (*text != 0)
+  {
+    while (isSpace(*text)) text++;
+    if (*text == 0) break;
+    const char* start = text;
+    while (*text != 0 && !isSpace(*text)) text++;
+    if (Count == TBC_COMMAND_MAX_ARGS)
+    {
+      // the last argument takes the remaining text, see rest()
+      Length[Count - 1] = text - Start[Count - 1];
+      continue;
+    }
+    Start[Count] = start;
+    Length[Count] = text - start;
+    Count++;
+  }
+}
+
+bool TBCCommandArgs::equals(uint8_t index, const char* value)
+{
+  if (index >= Count) return false;
+  return strncmp(Start[index], value, Length[index]) == 0 && value[Length[index]] == 0;
+}
+
+long TBCCommandArgs::toLong(uint8_t index)
+{
+  if (index >= Count) return 0;
+  // the argument ends at white space, strtol stops there
+  return strtol(Start[index], 0, 10);
+}
+
+size_t TBCCommandArgs::copy(uint8_t index, char* buffer, size_t size)
+{
+  if (size == 0) return 0;
+  size_t length = (index < Count) ? Length[index] : 0;
+  if (length > size - 1) length = size - 1;
+  if (length > 0) memcpy(buffer, Start[index], length);
+  buffer[length] = 0;
+  return length;
+}
+
+TBCCommandRouter::~TBCCommandRouter()
+{
+  if (Table != 0) free(Table);
+}
+
+uint32_t TBCCommandRouter::hash(const char* text, size_t length)
+{
+  uint32_t value = 2166136261UL ^ Seed;
+  for (size_t i = 0; i < length; i++)
+  {
+    value ^= (uint8_t) text[i];
+    value *= 16777619UL;
+  }
+  return value;
+}
+
+bool TBCCommandRouter::build()
+{
+  uint16_t size = 1;
+  while (size < 4 * Count) size <<= 1;
+  for (; size <= 4 * TBC_MAX_COMMANDS && size <= 256; size <<= 1)
+  {
+    uint8_t* table = (uint8_t*) realloc(Table, size);
+    if (table == 0) return false;
+    Table = table;
+    TableSize = size;
+    for (Seed = 0; Seed < TBC_COMMAND_SEEDS; Seed++)
+    {
+      memset(Table, TBC_COMMAND_EMPTY, size);
+      uint8_t index = 0;
+      for (; index < Count; index++)
+      {
+        uint16_t slot = hash(Commands[index].Name, Commands[index].Length) & (size - 1);
+        if (Table[slot] != TBC_COMMAND_EMPTY) break;
+        Table[slot] = index;
+      }
+      if (index == Count)
+      {
+        DOUTKV("Command table size", size);
+        DOUTKV("Command seed", Seed);
+        return true;
+      }
+    }
+  }
+  DOUT("No perfect hash found");
+  return false;
+}
+
+bool TBCCommandRouter::on(const char* command, TBCCommandCallback callbackCommand)
+{
+  if (command[0] == '/') command++;
+  size_t length = strlen(command);
+  if (Count >= TBC_MAX_COMMANDS || length == 0 || length > 255) return false;
+  for (uint8_t index = 0; index < Count; index++)
+  {
+    if (Commands[index].Length == length && strncmp(Commands[index].Name, command, length) == 0)
+    {
+      DOUTKV("Command registered already", command);
+      return false;
+    }
+  }
+  DOUTKV("on", command);
+  Commands[Count].Name = command;
+  Commands[Count].Length = length;
+  Commands[Count].callbackCommand = callbackCommand;
+  Count++;
+  if (build()) return true;
+  Count--;
+  build();
+  return false;
+}
+
+bool TBCCommandRouter::dispatch(Message* msg)
+{
+  if (Count == 0 || Table == 0) return false;
+  const char* text = msg->Text.c_str();
+  if (text[0] != '/') return false;
+  const char* command = ++text;
+  while (*text != 0 && *text != '@' && !isSpace(*text)) text++;
+  size_t length = text - command;
+  if (*text == '@')
+  {
+    // commands addressed to another bot in a group are not ours
+    const char* name = ++text;
+    while (*text != 0 && !isSpace(*text)) text++;
+    if (BotName != 0
+        && (strlen(BotName) != (size_t)(text - name) || strncasecmp(BotName, name, text - name) != 0))
+    {
+      DOUT("Command for another bot");
+      return false;
+    }
+  }
+  uint8_t index = Table[hash(command, length) & (TableSize - 1)];
+  if (index == TBC_COMMAND_EMPTY) return false;
+  TBCCommand& entry = Commands[index];
+  if (entry.Length != length || strncmp(entry.Name, command, length) != 0) return false;
+  if (entry.callbackCommand == 0) return false;
+  TBCCommandArgs args;
+  args.split(text);
+  DOUTKV("Command", entry.Name);
+  entry.callbackCommand(msg, args);
+  return true;
+}
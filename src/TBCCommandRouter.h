@@ -0,0 +1,234 @@
+/**
+    \file TBCCommandRouter.h
+    \brief Header of a router dispatching bot commands like /start
+           to handlers registered per command.
+
+    Part of TelegramBotClient (https://github.com/schlingensiepen/TelegramBotClient)
+    Jörn Schlingensiepen <joern@schlingensiepen.com>
+*/
+#pragma once
+#ifndef TBCCommandRouter_h
+#define TBCCommandRouter_h
+
+#include "TBCDebug.h"
+#include "Arduino.h"
+#include "TBCDelegate.h"
+
+/** Maximum number of commands registered */
+#ifndef TBC_MAX_COMMANDS
+#define TBC_MAX_COMMANDS 16
+#endif
+
+/** Maximum number of arguments split, further text is part of the last */
+#ifndef TBC_COMMAND_MAX_ARGS
+#define TBC_COMMAND_MAX_ARGS 8
+#endif
+
+struct Message;
+class TBCCommandArgs;
+
+/** Handler of a command called with the message and its arguments */
+typedef TBCDelegate<void(Message*, TBCCommandArgs&)> TBCCommandCallback;
+
+/**
+   \class TBCCommandArgs
+
+   \file TBCCommandRouter.h
+
+   \brief void onStart(Message* msg, TBCCommandArgs& args)
+
+   Arguments following a command, split at white space. The arguments
+   point into the text of the message, they are not terminated and
+   valid while the handler runs.
+
+   \note Should only be used as a part of TelegramBotClient
+   (https://github.com/schlingensiepen/TelegramBotClient)
+
+   \author Jörn Schlingensiepen <joern@schlingensiepen.com>
+
+*/
+class TBCCommandArgs
+{
+  private:
+    /** Start of each argument */
+    const char* Start[TBC_COMMAND_MAX_ARGS];
+    /** Length of each argument */
+    uint16_t Length[TBC_COMMAND_MAX_ARGS];
+    /** Number of arguments */
+    uint8_t Count = 0;
+  public:
+    /**
+        \brief Splits arguments
+
+        \param [in] text Text following the command, zero terminated
+        \return Nothing
+    */
+    void split(const char* text);
+    /**
+        \brief Number of arguments
+
+        \return Number of arguments, at most TBC_COMMAND_MAX_ARGS
+    */
+    uint8_t count() {
+      return Count;
+    }
+    /**
+        \brief Start of an argument
+
+        \param [in] index Index of the argument
+        \return Pointer to the argument, not terminated, 0 if index is out of range
+    */
+    const char* get(uint8_t index) {
+      return index < Count ? Start[index] : 0;
+    }
+    /**
+        \brief Length of an argument
+
+        \param [in] index Index of the argument
+        \return Length in bytes, 0 if index is out of range
+    */
+    uint16_t length(uint8_t index) {
+      return index < Count ? Length[index] : 0;
+    }
+    /**
+        \brief Text from an argument to the end of the message
+
+        \param [in] index Index of the argument
+        \return Zero terminated remainder of the text, "" if index is out of range
+    */
+    const char* rest(uint8_t index) {
+      return index < Count ? Start[index] : "";
+    }
+    /**
+        \brief Compares an argument
+
+        \param [in] index Index of the argument
+        \param [in] value Zero terminated value to compare with
+        \return True if the argument equals value
+    */
+    bool equals(uint8_t index, const char* value);
+    /**
+        \brief Converts an argument to a number
+
+        \param [in] index Index of the argument
+        \return The number, 0 if the argument is missing or not a number
+    */
+    long toLong(uint8_t index);
+    /**
+        \brief Copies an argument
+
+        \param [in] index Index of the argument
+        \param [out] buffer Buffer receiving the zero terminated argument
+        \param [in] size Size of buffer, longer arguments are truncated
+        \return Number of characters copied
+    */
+    size_t copy(uint8_t index, char* buffer, size_t size);
+};
+
+/**
+   \struct TBCCommand
+
+   \file TBCCommandRouter.h
+
+   \brief Command registered at TBCCommandRouter
+
+   \note Should only be used as a part of TelegramBotClient
+   (https://github.com/schlingensiepen/TelegramBotClient)
+
+   \author Jörn Schlingensiepen <joern@schlingensiepen.com>
+
+*/
+struct TBCCommand
+{
+  /** The command, zero terminated without leading slash */
+  const char* Name;
+  /** Length of Name */
+  uint8_t Length;
+  /** Handler of the command */
+  TBCCommandCallback callbackCommand;
+};
+
+/**
+   \class TBCCommandRouter
+
+   \file TBCCommandRouter.h
+
+   \brief router.on("/start", onStart); router.dispatch(msg);
+
+   Dispatches messages starting with a command to the handler registered
+   for the command. Commands addressed to another bot (/start@otherbot)
+   are ignored if the name of the bot is set. Commands are looked up by a
+   perfect hash built when commands are registered: a single hash and
+   compare per message regardless of the number of commands, without
+   temporary Strings.
+
+   \note Should only be used as a part of TelegramBotClient
+   (https://github.com/schlingensiepen/TelegramBotClient)
+
+   \author Jörn Schlingensiepen <joern@schlingensiepen.com>
+
+*/
+class TBCCommandRouter
+{
+  private:
+    /** Registered commands */
+    TBCCommand Commands[TBC_MAX_COMMANDS];
+    /** Number of registered commands */
+    uint8_t Count = 0;
+    /** Name of the bot without @, 0 to accept all */
+    const char* BotName = 0;
+    /** Hash table mapping to the index of a command, 0xff if empty */
+    uint8_t* Table = 0;
+    /** Size of Table, a power of two */
+    uint16_t TableSize = 0;
+    /** Seed of the hash function */
+    uint32_t Seed = 0;
+    /**
+        \brief Hash function, FNV-1a with seed
+
+        \param [in] text Text to hash
+        \param [in] length Length of text
+        \return The hash
+    */
+    uint32_t hash(const char* text, size_t length);
+    /**
+        \brief Builds the hash table
+
+        \return False if no perfect hash was found
+    */
+    bool build();
+  public:
+    /**
+        \brief Destructor
+    */
+    ~TBCCommandRouter();
+    /**
+        \brief Registers a command
+
+        \param [in] command The command with or without leading slash,
+        shall stay valid (e.g. a literal)
+        \param [in] callbackCommand Handler of the command
+        \return False if the command is registered already or
+        TBC_MAX_COMMANDS commands are registered
+    */
+    bool on(const char* command, TBCCommandCallback callbackCommand);
+    /**
+        \brief Sets the name of the bot
+
+        \param [in] botName Name without @, shall stay valid, 0 to accept
+        commands addressed to any bot
+        \return Nothing
+    */
+    void setBotName(const char* botName) {
+      BotName = botName;
+    }
+    /**
+        \brief Dispatches a message
+
+        \param [in] msg The message
+        \return True if a handler was called
+    */
+    bool dispatch(Message* msg);
+};
+
+#endif
@@ -0,0 +1,144 @@
+/**
+    \file TBCDelegate.h
+    \brief Header of a delegate calling free functions, small lambdas and
+           member functions without allocating memory. Used for all
+           callbacks of TelegramBotClient and JsonWebClient.
+
+    Part of TelegramBotClient (https://github.com/schlingensiepen/TelegramBotClient)
+    Jörn Schlingensiepen <joern@schlingensiepen.com>
+*/
+#pragma once
+#ifndef TBCDelegate_h
+#define TBCDelegate_h
+
+#include "Arduino.h"
+
+/** Tests a callable can be copied by memcpy and dropped without a
+    destructor. AVR has no <type_traits>, the compiler builtin behind
+    std::is_trivially_copyable is used there, it implies a trivial
+    destructor. */
+#if defined(__AVR__)
+#define TBC_DELEGATE_TRIVIAL(F) __is_trivially_copyable(F)
+#else
+#include <type_traits>
+#define TBC_DELEGATE_TRIVIAL(F) \
+  (std::is_trivially_copyable<F>::value && std::is_trivially_destructible<F>::value)
+#endif
+
+/** Size of the storage of a delegate, limits the captures of lambdas.
+    Holds an object pointer and a member function pointer. */
+#ifndef TBC_DELEGATE_SIZE
+#define TBC_DELEGATE_SIZE (3 * sizeof(void*))
+#endif
+
+template <typename Signature> class TBCDelegate;
+
+/**
+   \class TBCDelegate
+
+   \file TBCDelegate.h
+
+   \brief TBCDelegate<void(int)> callback(this, &MyBot::onValue);
+
+   Stores a callable in a small buffer inside the delegate: a function
+   pointer, a lambda whose captures fit into TBC_DELEGATE_SIZE and are
+   trivially copyable (pointers, references, numbers) or an object with
+   a member function. A call is a single indirect call, no memory is
+   allocated. Lambdas capturing e.g. a String are rejected at compile
+   time, capture a pointer instead. An empty delegate converts to false.
+
+   \note Should only be used as a part of TelegramBotClient
+   (https://github.com/schlingensiepen/TelegramBotClient)
+
+   \author Jörn Schlingensiepen <joern@schlingensiepen.com>
+
+*/
+template <typename R, typename... Args>
+class TBCDelegate<R(Args...)>
+{
+  private:
+    /** Storage of the callable, aligned for any capture */
+    union Storage
+    {
+      void* Pointer;
+      long long Number;
+      double Real;
+      char Bytes[TBC_DELEGATE_SIZE];
+    } Data;
+    /** Calls the stored callable, 0 if empty */
+    R (*Invoke)(const Storage&, Args...) = 0;
+
+    /** Object and member function stored by the delegate */
+    template <typename T> struct Member
+    {
+      T* Object;
+      R (T::*Method)(Args...);
+    };
+    template <typename F> static R invokeCallable(const Storage& data, Args... args)
+    {
+      return (*(F*) data.Bytes)(args...);
+    }
+    template <typename T> static R invokeMember(const Storage& data, Args... args)
+    {
+      const Member<T>& member = *(const Member<T>*) data.Bytes;
+      return (member.Object->*member.Method)(args...);
+    }
+
+  public:
+    /**
+        \brief Constructor of an empty delegate
+    */
+    TBCDelegate() {}
+    /**
+        \brief Constructor of an empty delegate, allows passing 0
+    */
+    TBCDelegate(int) {}
+    /**
+        \brief Constructor of an empty delegate, allows passing nullptr
+    */
+    TBCDelegate(decltype(nullptr)) {}
+    /**
+        \brief Constructor storing a function pointer or lambda
+        \param callable The callable, copied into the delegate
+    */
+    template <typename F> TBCDelegate(F callable)
+    {
+      static_assert(sizeof(F) <= TBC_DELEGATE_SIZE,
+                    "Captures too large for TBCDelegate, capture a pointer or raise TBC_DELEGATE_SIZE");
+      static_assert(TBC_DELEGATE_TRIVIAL(F),
+                    "TBCDelegate stores trivially copyable callables only, capture a pointer");
+      memcpy(Data.Bytes, &callable, sizeof(F));
+      Invoke = &invokeCallable<F>;
+    }
+    /**
+        \brief Constructor storing a member function
+        \param object The object, shall stay valid
+        \param method The member function called on object
+    */
+    template <typename T> TBCDelegate(T* object, R (T::*method)(Args...))
+    {
+      static_assert(sizeof(Member<T>) <= TBC_DELEGATE_SIZE,
+                    "Member function pointer too large for TBCDelegate, raise TBC_DELEGATE_SIZE");
+      Member<T> member;
+      member.Object = object;
+      member.Method = method;
+      memcpy(Data.Bytes, &member, sizeof(member));
+      Invoke = &invokeMember<T>;
+    }
+    /**
+        \brief Calls the stored callable, shall not be empty
+    */
+    R operator()(Args... args) const
+    {
+      return Invoke(Data, args...);
+    }
+    /**
+        \brief Checks the delegate is not empty
+    */
+    operator bool() const
+    {
+      return Invoke != 0;
+    }
+};
+
+#endif
@@ -0,0 +1,151 @@
+/**
+    \file TBCDispatcher.cpp
+    \brief Implementation of a dispatcher running the receive callback of
+           TelegramBotClient in worker threads.
+
+    Part of TelegramBotClient (https://github.com/schlingensiepen/TelegramBotClient)
+    Jörn Schlingensiepen <joern@schlingensiepen.com>
+*/
+
+#include "TBCDispatcher.h"
+
+#ifdef TBC_THREADS
+
+TBCDispatcher::TBCDispatcher(TBCReceiveCallback callbackReceive)
+{
+  DOUT("New TBCDispatcher");
+  this->callbackReceive = callbackReceive;
+  this->Running = false;
+  for (uint8_t i = 0; i < TBC_DISPATCH_WORKERS; i++)
+  {
+    Shards[i].Head = 0;
+    Shards[i].Tail = 0;
+    Shards[i].Owner = this;
+  }
+}
+
+TBCDispatcher::~TBCDispatcher()
+{
+  end();
+}
+
+bool TBCDispatcher::begin()
+{
+  if (Running) return true;
+  Running = true;
+  for (uint8_t i = 0; i < TBC_DISPATCH_WORKERS; i++)
+  {
+#ifdef ESP32
+    TaskHandle_t task = 0;
+    if (xTaskCreatePinnedToCore(work, "TBCWorker", TBC_DISPATCH_STACK,
+                                &Shards[i], 1, &task, TBC_DISPATCH_CORE) != pdPASS)
+    {
+      DOUT("Worker not created");
+      end();
+      return false;
+    }
+    Shards[i].Task = task;
+#else
+    Shards[i].Thread = std::thread(work, &Shards[i]);
+#endif
+  }
+  DOUTKV("Workers", TBC_DISPATCH_WORKERS);
+  return true;
+}
+
+void TBCDispatcher::end()
+{
+  if (!Running) return;
+  Running = false;
+  for (uint8_t i = 0; i < TBC_DISPATCH_WORKERS; i++)
+  {
+    signal(Shards[i]);
+#ifdef ESP32
+    // the task clears its handle before it deletes itself
+    while (Shards[i].Task != 0) delay(1);
+#else
+    if (Shards[i].Thread.joinable()) Shards[i].Thread.join();
+#endif
+    Shards[i].Head = Shards[i].Tail.load();
+  }
+}
+
+void TBCDispatcher::signal(TBCShard& shard)
+{
+#ifdef ESP32
+  if (shard.Task != 0) xTaskNotifyGive(shard.Task);
+#else
+  {
+    // taken to not miss a worker about to wait
+    std::lock_guard<std::mutex> lock(shard.WaitMutex);
+  }
+  shard.Wake.notify_one();
+#endif
+}
+
+void TBCDispatcher::work(void* data)
+{
+  TBCShard& shard = *(TBCShard*) data;
+  TBCDispatcher& owner = *shard.Owner;
+  while (owner.Running)
+  {
+    unsigned long head = shard.Head.load(std::memory_order_relaxed);
+    if (head == shard.Tail.load(std::memory_order_acquire))
+    {
+#ifdef ESP32
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+#else
+      std::unique_lock<std::mutex> lock(shard.WaitMutex);
+      shard.Wake.wait(lock, [&] {
+        return !owner.Running || shard.Head.load() != shard.Tail.load();
+      });
+#endif
+      continue;
+    }
+    Message& msg = shard.Slots[head % TBC_DISPATCH_QUEUE];
+    TBCCommandRouter* router = owner.Router;
+    if ((router == 0 || !router->dispatch(&msg)) && owner.callbackReceive != 0)
+      owner.callbackReceive(TelegramProcessError::Ok, JwcProcessError::Ok, &msg);
+    // the slot may be reused by the network thread from now on
+    shard.Head.store(head + 1, std::memory_order_release);
+  }
+#ifdef ESP32
+  shard.Task = 0;
+  vTaskDelete(0);
+#endif
+}
+
+bool TBCDispatcher::push(Message& msg)
+{
+  // messages of a chat always go to the same worker to keep their order
+  TBCShard& shard = Shards[(unsigned long) msg.ChatId % TBC_DISPATCH_WORKERS];
+  unsigned long tail = shard.Tail.load(std::memory_order_relaxed);
+  if (tail - shard.Head.load(std::memory_order_acquire) >= TBC_DISPATCH_QUEUE)
+  {
+    DOUT("Dispatch queue full");
+    return false;
+  }
+  shard.Slots[tail % TBC_DISPATCH_QUEUE] = msg;
+  shard.Tail.store(tail + 1, std::memory_order_release);
+  signal(shard);
+  return true;
+}
+
+bool TBCDispatcher::ready()
+{
+  for (uint8_t i = 0; i < TBC_DISPATCH_WORKERS; i++)
+  {
+    if (Shards[i].Tail.load() - Shards[i].Head.load() >= TBC_DISPATCH_QUEUE) return false;
+  }
+  return true;
+}
+
+unsigned long TBCDispatcher::pending()
+{
+  unsigned long count = 0;
+  for (uint8_t i = 0; i < TBC_DISPATCH_WORKERS; i++)
+    count += Shards[i].Tail.load() - Shards[i].Head.load();
+  return count;
+}
+
+#endif
@@ -0,0 +1,197 @@
+/**
+    \file TBCDispatcher.h
+    \brief Header of a dispatcher running the receive callback of
+           TelegramBotClient in worker threads, thus slow handlers
+           do not stall network processing.
+
+    Part of TelegramBotClient (https://github.com/schlingensiepen/TelegramBotClient)
+    Jörn Schlingensiepen <joern@schlingensiepen.com>
+*/
+#pragma once
+#ifndef TBCDispatcher_h
+#define TBCDispatcher_h
+
+#include "TBCDebug.h"
+#include "Arduino.h"
+#include "TBCMutex.h"
+#include "TelegramBotClient.h"
+
+#ifdef TBC_THREADS
+
+#include <atomic>
+#ifdef ESP32
+#include "freertos/task.h"
+#else
+#include <thread>
+#include <condition_variable>
+#endif
+
+/** Number of workers, updates are distributed by chat */
+#ifndef TBC_DISPATCH_WORKERS
+#ifdef ESP32
+#define TBC_DISPATCH_WORKERS 2
+#else
+#define TBC_DISPATCH_WORKERS 4
+#endif
+#endif
+
+/** Number of updates queued per worker */
+#ifndef TBC_DISPATCH_QUEUE
+#define TBC_DISPATCH_QUEUE 8
+#endif
+
+/** Stack size of a worker task in bytes (ESP32) */
+#ifndef TBC_DISPATCH_STACK
+#define TBC_DISPATCH_STACK 8192
+#endif
+
+/** Core the worker tasks run on (ESP32) */
+#ifndef TBC_DISPATCH_CORE
+#define TBC_DISPATCH_CORE tskNO_AFFINITY
+#endif
+
+class TBCDispatcher;
+
+/**
+   \struct TBCShard
+
+   \file TBCDispatcher.h
+
+   \brief Queue and worker of TBCDispatcher
+
+   Single producer single consumer ring: the network thread writes
+   the slot at Tail, the worker handles the slot at Head.
+
+   \note Should only be used as a part of TelegramBotClient
+   (https://github.com/schlingensiepen/TelegramBotClient)
+
+   \author Jörn Schlingensiepen <joern@schlingensiepen.com>
+
+*/
+struct TBCShard
+{
+  /** Queued updates */
+  Message Slots[TBC_DISPATCH_QUEUE];
+  /** Number of updates handled */
+  std::atomic<unsigned long> Head;
+  /** Number of updates queued */
+  std::atomic<unsigned long> Tail;
+  /** Dispatcher owning the shard */
+  TBCDispatcher* Owner;
+#ifdef ESP32
+  /** Worker task, 0 if not running */
+  TaskHandle_t volatile Task = 0;
+#else
+  /** Worker thread */
+  std::thread Thread;
+  /** Mutex used to sleep while the queue is empty */
+  std::mutex WaitMutex;
+  /** Signals queued updates */
+  std::condition_variable Wake;
+#endif
+};
+
+/**
+   \class TBCDispatcher
+
+   \file TBCDispatcher.h
+
+   \brief TBCDispatcher dispatcher(onReceive); bot.setDispatcher(&dispatcher);
+
+   Received messages are copied into a queue per worker and the
+   callback is called by the worker. Messages are distributed by
+   ChatId: messages of a chat are handled by the same worker in the order
+   received, messages of different chats in parallel. While a queue is
+   full the bot does not poll. Callbacks may post, TelegramBotClient is
+   locked while it is used. The update is acknowledged to Telegram when
+   it is queued, updates queued are lost by a restart.
+
+   \note Should only be used as a part of TelegramBotClient
+   (https://github.com/schlingensiepen/TelegramBotClient)
+
+   \author Jörn Schlingensiepen <joern@schlingensiepen.com>
+
+*/
+class TBCDispatcher
+{
+  private:
+    /** Queues and workers */
+    TBCShard Shards[TBC_DISPATCH_WORKERS];
+    /** Indicates the workers shall run */
+    std::atomic<bool> Running;
+    /** Callback called by the workers */
+    TBCReceiveCallback callbackReceive;
+    /** Router of commands called before callbackReceive, 0 if none */
+    TBCCommandRouter* volatile Router = 0;
+    /**
+        \brief Worker handling the updates of a shard
+
+        \param [in] shard The TBCShard
+        \return Nothing
+    */
+    static void work(void* shard);
+    /**
+        \brief Wakes the worker of a shard
+
+        \param [in] shard The shard
+        \return Nothing
+    */
+    void signal(TBCShard& shard);
+  public:
+    /**
+        \brief Constructor
+        \param callbackReceive Callback called by the workers
+    */
+    TBCDispatcher(TBCReceiveCallback callbackReceive);
+    /**
+        \brief Destructor, stops the workers
+    */
+    ~TBCDispatcher();
+    /**
+        \brief Starts the workers
+
+        \return True on success
+    */
+    bool begin();
+    /**
+        \brief Stops the workers
+
+        \return Nothing
+
+        \details Waits for the workers to finish the update they
+        are handling, queued updates are dropped.
+    */
+    void end();
+    /**
+        \brief Queues a message
+
+        \param [in] msg The message, copied into the queue
+        \return False if the queue of the chat is full
+    */
+    bool push(Message& msg);
+    /**
+        \brief Checks for free space
+
+        \return True if each queue can take another message
+    */
+    bool ready();
+    /**
+        \brief Sets the router of commands
+
+        \param [in] router Router called by the workers before
+        callbackReceive, set by TelegramBotClient::setDispatcher()
+        \return Nothing
+    */
+    void setRouter(TBCCommandRouter* router) {
+      Router = router;
+    }
+    /**
+        \brief Number of queued messages
+
+        \return Number of messages queued or being handled
+    */
+    unsigned long pending();
+};
+
+#endif
+#endif
@@ -0,0 +1,158 @@
+/**
+    \file TBCEpollRunner.cpp
+    \brief Implementation of a runner driving TelegramBotClients by epoll.
+
+    Part of TelegramBotClient (https://github.com/schlingensiepen/TelegramBotClient)
+    Jörn Schlingensiepen <joern@schlingensiepen.com>
+*/
+
+#include "TBCEpollRunner.h"
+
+#ifdef TBC_EPOLL_RUNNER
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+/** Data of the event of WakeFd, outside the range of entry indices */
+#define TBC_EPOLL_WAKE UINT64_MAX
+
+TBCEpollRunner::TBCEpollRunner(unsigned long tick)
+{
+  DOUT("New TBCEpollRunner");
+  this->Tick = tick;
+  this->EpollFd = epoll_create1(EPOLL_CLOEXEC);
+  this->WakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  struct epoll_event event;
+  event.events = EPOLLIN;
+  event.data.u64 = TBC_EPOLL_WAKE;
+  epoll_ctl(EpollFd, EPOLL_CTL_ADD, WakeFd, &event);
+}
+
+TBCEpollRunner::~TBCEpollRunner()
+{
+  close(WakeFd);
+  close(EpollFd);
+}
+
+bool TBCEpollRunner::add(TelegramBotClient& bot, TBCPosixClient& pollClient, TBCPosixClient& postClient)
+{
+  if (Count >= TBC_EPOLL_MAX_BOTS) return false;
+  TBCEpollEntry& entry = Entries[Count++];
+  entry.Bot = &bot;
+  entry.Clients[0] = &pollClient;
+  entry.Clients[1] = (&postClient != &pollClient) ? &postClient : 0;
+  entry.Ready = true;
+  DOUTKV("Bots", Count);
+  return true;
+}
+
+void TBCEpollRunner::remove(TelegramBotClient& bot)
+{
+  for (uint8_t index = 0; index < Count; index++)
+  {
+    if (Entries[index].Bot != &bot) continue;
+    for (uint8_t slot = 0; slot < 2; slot++)
+    {
+      TBCPosixClient* client = Entries[index].Clients[slot];
+      if (client != 0 && client->fd() >= 0) epoll_ctl(EpollFd, EPOLL_CTL_DEL, client->fd(), 0);
+    }
+    Entries[index] = Entries[--Count];
+    return;
+  }
+}
+
+bool TBCEpollRunner::watch(TBCPosixClient* client, uint8_t index)
+{
+  if (client == 0 || client->fd() < 0) return false;
+  struct epoll_event event;
+  uint32_t events = EPOLLIN | EPOLLRDHUP;
+  if (client->wantsWrite()) events |= EPOLLOUT;
+  event.events = events;
+  event.data.u64 = index;
+  // closed descriptors leave epoll by themselves and their numbers are
+  // reused by reconnects, thus the registration is refreshed each round
+  if (epoll_ctl(EpollFd, EPOLL_CTL_MOD, client->fd(), &event) != 0 && errno == ENOENT)
+    epoll_ctl(EpollFd, EPOLL_CTL_ADD, client->fd(), &event);
+  // data buffered by the client or TLS does not wake epoll
+  return client->available() > 0;
+}
+
+bool TBCEpollRunner::runOnce(int timeout)
+{
+  bool ready = false;
+  for (uint8_t index = 0; index < Count; index++)
+  {
+    TBCEpollEntry& entry = Entries[index];
+    if (watch(entry.Clients[0], index)) entry.Ready = true;
+    if (watch(entry.Clients[1], index)) entry.Ready = true;
+    ready |= entry.Ready;
+  }
+
+  unsigned long elapsed = millis() - LastTick;
+  int wait = (elapsed < Tick) ? (int)(Tick - elapsed) : 0;
+  if (timeout >= 0 && timeout < wait) wait = timeout;
+  if (ready) wait = 0;
+
+  struct epoll_event events[2 * TBC_EPOLL_MAX_BOTS + 1];
+  int count = epoll_wait(EpollFd, events, 2 * TBC_EPOLL_MAX_BOTS + 1, wait);
+  if (count < 0 && errno != EINTR)
+  {
+    DOUT("epoll_wait failed");
+  }
+  bool tick = (millis() - LastTick) >= Tick;
+  for (int i = 0; i < count; i++)
+  {
+    if (events[i].data.u64 == TBC_EPOLL_WAKE)
+    {
+      uint64_t value;
+      if (read(WakeFd, &value, sizeof(value)) > 0) tick = true;
+      continue;
+    }
+    TBCEpollEntry& entry = Entries[events[i].data.u64];
+    entry.Ready = true;
+    if (events[i].events & EPOLLOUT)
+    {
+      if (entry.Clients[0] != 0) entry.Clients[0]->sendPending();
+      if (entry.Clients[1] != 0) entry.Clients[1]->sendPending();
+    }
+  }
+  if (tick) LastTick = millis();
+
+  bool looped = false;
+  for (uint8_t index = 0; index < Count; index++)
+  {
+    TBCEpollEntry& entry = Entries[index];
+    if (!entry.Ready && !tick) continue;
+    // failing connects are retried by the tick, not in a busy loop
+    entry.Ready = false;
+    entry.Bot->loop();
+    looped = true;
+  }
+  return looped;
+}
+
+void TBCEpollRunner::run()
+{
+  DOUT("run");
+  Stopped = false;
+  while (!Stopped) runOnce();
+}
+
+void TBCEpollRunner::stop()
+{
+  Stopped = true;
+  wake();
+}
+
+void TBCEpollRunner::wake()
+{
+  uint64_t value = 1;
+  if (write(WakeFd, &value, sizeof(value)) < 0)
+  {
+    DOUT("wake failed");
+  }
+}
+
+#endif
@@ -0,0 +1,172 @@
+/**
+    \file TBCEpollRunner.h
+    \brief Header of a runner driving TelegramBotClients by epoll,
+           it sleeps until a connection is ready or a timer is due
+           instead of calling loop() continuously.
+
+    Part of TelegramBotClient (https://github.com/schlingensiepen/TelegramBotClient)
+    Jörn Schlingensiepen <joern@schlingensiepen.com>
+*/
+#pragma once
+#ifndef TBCEpollRunner_h
+#define TBCEpollRunner_h
+
+#include "TBCDebug.h"
+#include "Arduino.h"
+#include "TelegramBotClient.h"
+#include "TBCPosixClient.h"
+
+#if defined(__linux__) && defined(TBC_POSIX_CLIENT)
+#define TBC_EPOLL_RUNNER
+#endif
+
+#ifdef TBC_EPOLL_RUNNER
+
+/** Maximum number of bots driven by one runner */
+#ifndef TBC_EPOLL_MAX_BOTS
+#define TBC_EPOLL_MAX_BOTS 16
+#endif
+
+/** Interval in milliseconds the bots are looped without network events,
+    bounds the delay of timers like the post interval or poll pauses */
+#ifndef TBC_EPOLL_TICK
+#define TBC_EPOLL_TICK 100
+#endif
+
+/**
+   \struct TBCEpollEntry
+
+   \file TBCEpollRunner.h
+
+   \brief A bot driven by TBCEpollRunner
+
+   \note Should only be used as a part of TelegramBotClient
+   (https://github.com/schlingensiepen/TelegramBotClient)
+
+   \author Jörn Schlingensiepen <joern@schlingensiepen.com>
+
+*/
+struct TBCEpollEntry
+{
+  /** The bot */
+  TelegramBotClient* Bot;
+  /** Clients used by the bot for polling and posting, may be the same */
+  TBCPosixClient* Clients[2];
+  /** Indicates the bot shall be looped */
+  bool Ready;
+};
+
+/**
+   \class TBCEpollRunner
+
+   \file TBCEpollRunner.h
+
+   \brief TBCEpollRunner runner; runner.add(bot, pollClient, postClient); runner.run();
+
+   Drives TelegramBotClients using TBCPosixClient. Each bot is looped when
+   one of its sockets is readable or writable, when data is buffered and
+   every tick (TBC_EPOLL_TICK) for timers. In between the thread sleeps in epoll_wait(), an idle
+   gateway uses almost no CPU. The bots are looped in the thread calling
+   run(), wake() and stop() may be called from other threads.
+
+   \note Should only be used as a part of TelegramBotClient
+   (https://github.com/schlingensiepen/TelegramBotClient)
+
+   \author Jörn Schlingensiepen <joern@schlingensiepen.com>
+
+*/
+class TBCEpollRunner
+{
+  private:
+    /** Epoll descriptor */
+    int EpollFd;
+    /** Eventfd used to wake the runner */
+    int WakeFd;
+    /** Bots driven */
+    TBCEpollEntry Entries[TBC_EPOLL_MAX_BOTS];
+    /** Number of entries */
+    uint8_t Count = 0;
+    /** Interval in milliseconds all bots are looped */
+    unsigned long Tick;
+    /** Time the bots were looped by the tick */
+    unsigned long LastTick = 0;
+    /** Indicates run() shall return */
+    volatile bool Stopped = false;
+    /**
+        \brief Registers the current socket of a client
+
+        \param [in] client Client to watch
+        \param [in] index Index of the entry
+        \return True if the client has buffered data
+    */
+    bool watch(TBCPosixClient* client, uint8_t index);
+
+  public:
+    /**
+        \brief Constructor
+        \param tick Optional. Interval in milliseconds all bots are looped
+    */
+    TBCEpollRunner(unsigned long tick = TBC_EPOLL_TICK);
+    /**
+        \brief Destructor
+    */
+    ~TBCEpollRunner();
+    /**
+        \brief Adds a bot
+
+        \param [in] bot The bot, begin() shall be called already
+        \param [in] pollClient Client passed to the bot for polling
+        \param [in] postClient Client passed to the bot for posting
+        \return False if TBC_EPOLL_MAX_BOTS bots are added already
+    */
+    bool add(TelegramBotClient& bot, TBCPosixClient& pollClient, TBCPosixClient& postClient);
+    /**
+        \brief Adds a bot using a single client
+
+        \param [in] bot The bot, begin() shall be called already
+        \param [in] client Client passed to the bot
+        \return False if TBC_EPOLL_MAX_BOTS bots are added already
+    */
+    bool add(TelegramBotClient& bot, TBCPosixClient& client) {
+      return add(bot, client, client);
+    }
+    /**
+        \brief Removes a bot
+
+        \param [in] bot The bot
+        \return Nothing
+    */
+    void remove(TelegramBotClient& bot);
+    /**
+        \brief Waits for events and loops the bots once
+
+        \param [in] timeout Optional. Maximum time to wait in milliseconds,
+        -1 to wait until the next tick
+        \return True if a bot was looped
+    */
+    bool runOnce(int timeout = -1);
+    /**
+        \brief Loops the bots until stop() is called
+
+        \return Nothing
+    */
+    void run();
+    /**
+        \brief Stops run()
+
+        \return Nothing
+    */
+    void stop();
+    /**
+        \brief Wakes the runner to loop all bots
+
+        \return Nothing
+
+        \details Shall be called after e.g. queueing a message from
+        another thread to avoid waiting for the next tick.
+    */
+    void wake();
+};
+
+#endif
+#endif
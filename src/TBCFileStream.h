@@ -0,0 +1,107 @@
+/**
+    \file TBCFileStream.h
+    \brief Header of a Stream reading and writing a file on unix like systems,
+           allows files to be used as source of uploads.
+
+    Part of TelegramBotClient (https://github.com/schlingensiepen/TelegramBotClient)
+    Jörn Schlingensiepen <joern@schlingensiepen.com>
+*/
+#pragma once
+#ifndef TBCFileStream_h
+#define TBCFileStream_h
+
+#if defined(__unix__)
+
+#include "Arduino.h"
+#include <stdio.h>
+
+/**
+   \class TBCFileStream
+
+   \file TBCFileStream.h
+
+   \brief TBCFileStream file("log.csv");
+
+   Minimal Stream implementation on top of a stdio file.
+
+   \note Should only be used as a part of TelegramBotClient
+   (https://github.com/schlingensiepen/TelegramBotClient)
+
+   \author Jörn Schlingensiepen <joern@schlingensiepen.com>
+
+*/
+class TBCFileStream : public Stream
+{
+  private:
+    /** The open file, 0 if opening failed */
+    FILE* File;
+  public:
+    /**
+        \brief Constructor
+        \param path Path of the file
+        \param mode Mode passed to fopen()
+    */
+    TBCFileStream(const char* path, const char* mode = "rb") {
+      File = fopen(path, mode);
+    }
+    /**
+        \brief Destructor, closes the file
+    */
+    ~TBCFileStream() {
+      if (File != 0) fclose(File);
+    }
+    /**
+        \brief Indicates if the file was opened
+
+        \return True if the file is open
+    */
+    bool isOpen() {
+      return File != 0;
+    }
+    /**
+        \brief Size of the file
+
+        \return Size of the file in bytes
+    */
+    size_t size() {
+      if (File == 0) return 0;
+      long pos = ftell(File);
+      fseek(File, 0, SEEK_END);
+      long end = ftell(File);
+      fseek(File, pos, SEEK_SET);
+      return end < 0 ? 0 : (size_t) end;
+    }
+    int available() {
+      if (File == 0) return 0;
+      long pos = ftell(File);
+      long end = (long) size();
+      return end > pos ? (int) (end - pos) : 0;
+    }
+    int read() {
+      if (File == 0) return -1;
+      int c = fgetc(File);
+      return c == EOF ? -1 : c;
+    }
+    int peek() {
+      if (File == 0) return -1;
+      int c = fgetc(File);
+      if (c == EOF) return -1;
+      ungetc(c, File);
+      return c;
+    }
+    using Print::write;
+    size_t write(uint8_t c) {
+      if (File == 0) return 0;
+      return fputc(c, File) == EOF ? 0 : 1;
+    }
+    size_t write(const uint8_t* buffer, size_t size) {
+      if (File == 0) return 0;
+      return fwrite(buffer, 1, size, File);
+    }
+    void flush() {
+      if (File != 0) fflush(File);
+    }
+};
+
+#endif
+#endif
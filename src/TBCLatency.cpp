@@ -0,0 +1,165 @@
+/**
+    \file TBCLatency.cpp
+    \brief Implementation of latency histograms of the stages between an
+           update sent by a user and the acknowledgement of the reply.
+
+    Part of TelegramBotClient (https://github.com/schlingensiepen/TelegramBotClient)
+    Jörn Schlingensiepen <joern@schlingensiepen.com>
+*/
+
+#include "TBCLatency.h"
+
+/** Longest age of an update in seconds, keeps timestamps comparable */
+#define TBC_LATENCY_MAX_AGE 1800
+
+const __FlashStringHelper* toString(TBCStage stage)
+{
+  switch (stage)
+  {
+    case TBCStage::PollFired: return F("PollFired");
+    case TBCStage::FirstByte: return F("FirstByte");
+    case TBCStage::Headers: return F("Headers");
+    case TBCStage::Parsed: return F("Parsed");
+    case TBCStage::CallbackEntered: return F("CallbackEntered");
+    case TBCStage::CallbackReturned: return F("CallbackReturned");
+    case TBCStage::ReplyQueued: return F("ReplyQueued");
+    case TBCStage::ReplyAcked: return F("ReplyAcked");
+    case TBCStage::Total: return F("Total");
+  }
+  return F("Unknown");
+}
+
+TBCLatency::TBCLatency()
+{
+  reset();
+}
+
+void TBCLatency::reset()
+{
+  memset(Counts, 0, sizeof(Counts));
+}
+
+void TBCLatency::add(TBCStage stage, unsigned long duration)
+{
+  uint8_t bucket = 0;
+  while (duration > 0 && bucket < TBC_LATENCY_BUCKETS - 1)
+  {
+    duration >>= 1;
+    bucket++;
+  }
+  Counts[(uint8_t) stage][bucket]++;
+}
+
+void TBCLatency::add(TBCStage stage, unsigned long begin, unsigned long end)
+{
+  long duration = (long) (end - begin);
+  if (duration < 0) return;
+  add(stage, (unsigned long) duration);
+}
+
+void TBCLatency::received(const JwcTimes& times, unsigned long date)
+{
+  unsigned long age = 0;
+  if (times.ServerDate != 0 && date != 0 && times.ServerDate > date)
+    age = times.ServerDate - date;
+  if (age > TBC_LATENCY_MAX_AGE) age = TBC_LATENCY_MAX_AGE;
+  DOUTKV("Update age", age);
+  Origin = times.FirstByte - age * 1000000UL;
+  Parsed = times.Parsed;
+  if ((long) (times.Fired - Origin) > 0)
+  {
+    add(TBCStage::PollFired, Origin, times.Fired);
+    add(TBCStage::FirstByte, times.Fired, times.FirstByte);
+  }
+  else
+  {
+    // the poll was waiting when the update was sent
+    add(TBCStage::PollFired, 0);
+    add(TBCStage::FirstByte, Origin, times.FirstByte);
+  }
+  add(TBCStage::Headers, times.FirstByte, times.Headers);
+  add(TBCStage::Parsed, times.Headers, times.Parsed);
+}
+
+void TBCLatency::enter()
+{
+  Entered = micros();
+  InCallback = true;
+  add(TBCStage::CallbackEntered, Parsed, Entered);
+}
+
+void TBCLatency::leave()
+{
+  InCallback = false;
+  add(TBCStage::CallbackReturned, Entered, micros());
+}
+
+uint32_t TBCLatency::count(TBCStage stage, uint8_t bucket)
+{
+  if (bucket >= TBC_LATENCY_BUCKETS) return 0;
+  return Counts[(uint8_t) stage][bucket];
+}
+
+uint32_t TBCLatency::samples(TBCStage stage)
+{
+  uint32_t sum = 0;
+  for (uint8_t i = 0; i < TBC_LATENCY_BUCKETS; i++) sum += Counts[(uint8_t) stage][i];
+  return sum;
+}
+
+unsigned long TBCLatency::bucketLimit(uint8_t bucket)
+{
+  if (bucket >= TBC_LATENCY_BUCKETS - 1) return 0;
+  return 1UL << bucket;
+}
+
+unsigned long TBCLatency::percentile(TBCStage stage, uint8_t percent)
+{
+  uint32_t total = samples(stage);
+  if (total == 0) return 0;
+  // rank of the percentile, rounded up
+  uint32_t rank = (uint32_t) (((uint64_t) total * percent + 99) / 100);
+  if (rank == 0) rank = 1;
+  uint32_t sum = 0;
+  for (uint8_t i = 0; i < TBC_LATENCY_BUCKETS; i++)
+  {
+    sum += Counts[(uint8_t) stage][i];
+    if (sum >= rank) return bucketLimit(i);
+  }
+  return 0;
+}
+
+/**
+    \brief Prints the limit of a bucket
+
+    \param [in] out Destination
+    \param [in] limit Limit in microseconds, 0 for the open last bucket
+*/
+static void printLimit(Print& out, unsigned long limit)
+{
+  if (limit == 0)
+  {
+    out.print(F("inf"));
+    return;
+  }
+  out.print(limit);
+  out.print(F("us"));
+}
+
+void TBCLatency::printTo(Print& out)
+{
+  for (uint8_t i = 0; i < TBC_STAGES; i++)
+  {
+    TBCStage stage = (TBCStage) i;
+    uint32_t n = samples(stage);
+    if (n == 0) continue;
+    out.print(toString(stage));
+    out.print(F(" n="));
+    out.print(n);
+    out.print(F(" p50<"));
+    printLimit(out, percentile(stage, 50));
+    out.print(F(" p99<"));
+    printLimit(out, percentile(stage, 99));
+    out.println();
+  }
+}
@@ -0,0 +1,211 @@
+/**
+    \file TBCLatency.h
+    \brief Header of latency histograms of the stages between an update
+           sent by a user and the acknowledgement of the reply.
+
+    Part of TelegramBotClient (https://github.com/schlingensiepen/TelegramBotClient)
+    Jörn Schlingensiepen <joern@schlingensiepen.com>
+*/
+#pragma once
+#ifndef TBCLatency_h
+#define TBCLatency_h
+
+#include "TBCDebug.h"
+#include "Arduino.h"
+#include "JsonWebClient.h"
+
+/**
+    Number of buckets per histogram, bucket n counts durations below
+    2^n microseconds, the last bucket counts all longer durations
+*/
+#ifndef TBC_LATENCY_BUCKETS
+#define TBC_LATENCY_BUCKETS 28
+#endif
+
+/** Number of stages in TBCStage */
+#define TBC_STAGES 9
+
+/**
+   \enum TBCStage
+
+   \file TBCLatency.h
+
+   \brief Stages measured by TBCLatency.
+
+   \details Each stage is measured from the stage before it, the date
+   of the update sent by the user is the origin of all stages.
+
+   \note Should only be used as a part of TelegramBotClient
+   (https://github.com/schlingensiepen/TelegramBotClient)
+
+   \author Jörn Schlingensiepen <joern@schlingensiepen.com>
+
+*/
+enum class TBCStage : uint8_t
+{
+  /** Origin to the poll fetching the update, 0 if it was already waiting */
+  PollFired = 0,
+  /** Poll or origin to the first byte of the response */
+  FirstByte = 1,
+  /** First byte to headers parsed */
+  Headers = 2,
+  /** Headers parsed to JSON parsed, includes receiving the body */
+  Parsed = 3,
+  /** JSON parsed to the callback or command handler entered */
+  CallbackEntered = 4,
+  /** Callback entered to returned */
+  CallbackReturned = 5,
+  /** Callback entered to the reply queued */
+  ReplyQueued = 6,
+  /** Reply queued to its post acknowledged */
+  ReplyAcked = 7,
+  /** Origin to the reply acknowledged */
+  Total = 8
+};
+
+/**
+    \brief Name of a TBCStage
+
+    \param [in] stage The stage
+    \return The name stored in flash
+*/
+const __FlashStringHelper* toString(TBCStage stage);
+
+/**
+   \class TBCLatency
+
+   \file TBCLatency.h
+
+   \brief TBCLatency latency; client.setLatency(&latency);
+
+   Log scale histograms of the stages of handling an update. Telegram's
+   date of an update has a resolution of a second, the origin is
+   placed by the Date header of the response delivering the update, so
+   stages measured from the origin are exact to a second only.
+
+   \note Should only be used as a part of TelegramBotClient
+   (https://github.com/schlingensiepen/TelegramBotClient)
+
+   \author Jörn Schlingensiepen <joern@schlingensiepen.com>
+
+*/
+class TBCLatency
+{
+  private:
+    /** Counts of the buckets of every stage */
+    uint32_t Counts[TBC_STAGES][TBC_LATENCY_BUCKETS];
+    /** Local time of the origin of the current update */
+    unsigned long Origin = 0;
+    /** Local time the current update was parsed */
+    unsigned long Parsed = 0;
+    /** Local time the callback of the current update was entered */
+    unsigned long Entered = 0;
+    /** Indicates the callback of the current update runs */
+    bool InCallback = false;
+
+  public:
+    /**
+        \brief Constructor, clears all histograms
+    */
+    TBCLatency();
+    /**
+        \brief Clears all histograms
+    */
+    void reset();
+    /**
+        \brief Adds a duration to the histogram of a stage
+
+        \param [in] stage The stage
+        \param [in] duration Duration in microseconds
+    */
+    void add(TBCStage stage, unsigned long duration);
+    /**
+        \brief Adds the time between two timestamps
+
+        \details Nothing is added if the end is before the begin.
+        \param [in] stage The stage
+        \param [in] begin Timestamp in microseconds the stage began
+        \param [in] end Timestamp in microseconds the stage ended
+    */
+    void add(TBCStage stage, unsigned long begin, unsigned long end);
+    /**
+        \brief Starts measuring a received update
+
+        \details Adds PollFired, FirstByte, Headers and Parsed.
+        \param [in] times Timestamps of the response delivering the update
+        \param [in] date Date of the update in seconds since 1970
+    */
+    void received(const JwcTimes& times, unsigned long date);
+    /**
+        \brief Marks the callback of the current update entered
+    */
+    void enter();
+    /**
+        \brief Marks the callback of the current update returned
+    */
+    void leave();
+    /**
+        \brief Indicates the callback of an update runs
+
+        \return True between enter() and leave()
+    */
+    bool inCallback() {
+      return InCallback;
+    }
+    /**
+        \brief Local time of the origin of the current update
+
+        \return Timestamp in microseconds
+    */
+    unsigned long origin() {
+      return Origin;
+    }
+    /**
+        \brief Local time the callback of the current update was entered
+
+        \return Timestamp in microseconds
+    */
+    unsigned long entered() {
+      return Entered;
+    }
+    /**
+        \brief Count of a bucket
+
+        \param [in] stage The stage
+        \param [in] bucket Index of the bucket
+        \return Number of durations counted in the bucket
+    */
+    uint32_t count(TBCStage stage, uint8_t bucket);
+    /**
+        \brief Number of durations of a stage
+
+        \param [in] stage The stage
+        \return Sum of all buckets
+    */
+    uint32_t samples(TBCStage stage);
+    /**
+        \brief Upper limit of a bucket
+
+        \param [in] bucket Index of the bucket
+        \return Limit in microseconds, 0 for the open last bucket
+    */
+    static unsigned long bucketLimit(uint8_t bucket);
+    /**
+        \brief Percentile of a stage
+
+        \param [in] stage The stage
+        \param [in] percent Percentage of durations, e.g. 50 or 99
+        \return Upper limit in microseconds of the bucket holding the
+                percentile, 0 if no durations were added or the
+                percentile is in the last bucket
+    */
+    unsigned long percentile(TBCStage stage, uint8_t percent);
+    /**
+        \brief Prints the stages with samples, median and 99th percentile
+
+        \param [in] out Destination, e.g. Serial
+    */
+    void printTo(Print& out);
+};
+
+#endif
@@ -0,0 +1,136 @@
+/**
+    \file TBCMutex.h
+    \brief Header of a recursive mutex protecting TelegramBotClient when
+           it is used from several threads, e.g. by TBCDispatcher workers.
+           On platforms without threads it does nothing.
+
+    Part of TelegramBotClient (https://github.com/schlingensiepen/TelegramBotClient)
+    Jörn Schlingensiepen <joern@schlingensiepen.com>
+*/
+#pragma once
+#ifndef TBCMutex_h
+#define TBCMutex_h
+
+#include "Arduino.h"
+
+#if defined(ESP32) || defined(__linux__)
+#define TBC_THREADS
+#endif
+
+#ifdef TBC_THREADS
+#ifdef ESP32
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#else
+#include <mutex>
+#endif
+#endif
+
+/**
+   \class TBCMutex
+
+   \file TBCMutex.h
+
+   \brief TBCMutex mutex;
+
+   Recursive mutex, a thread holding it may lock it again, e.g. by
+   posting from a callback called inside TelegramBotClient::loop().
+
+   \note Should only be used as a part of TelegramBotClient
+   (https://github.com/schlingensiepen/TelegramBotClient)
+
+   \author Jörn Schlingensiepen <joern@schlingensiepen.com>
+
+*/
+class TBCMutex
+{
+  private:
+#ifdef TBC_THREADS
+#ifdef ESP32
+    /** FreeRTOS recursive mutex */
+    SemaphoreHandle_t Handle = xSemaphoreCreateRecursiveMutex();
+#else
+    /** Standard recursive mutex */
+    std::recursive_mutex Handle;
+#endif
+#endif
+  public:
+    /**
+        \brief Constructor
+    */
+    TBCMutex() {}
+    /**
+        \brief Destructor, releases the FreeRTOS semaphore
+    */
+    ~TBCMutex() {
+#if defined(TBC_THREADS) && defined(ESP32)
+      vSemaphoreDelete(Handle);
+#endif
+    }
+    /** A mutex owns its handle, it can not be copied */
+    TBCMutex(const TBCMutex&) = delete;
+    /** A mutex owns its handle, it can not be assigned */
+    TBCMutex& operator=(const TBCMutex&) = delete;
+    /**
+        \brief Locks the mutex, waits until it is available
+    */
+    void lock() {
+#ifdef TBC_THREADS
+#ifdef ESP32
+      xSemaphoreTakeRecursive(Handle, portMAX_DELAY);
+#else
+      Handle.lock();
+#endif
+#endif
+    }
+    /**
+        \brief Unlocks the mutex
+    */
+    void unlock() {
+#ifdef TBC_THREADS
+#ifdef ESP32
+      xSemaphoreGiveRecursive(Handle);
+#else
+      Handle.unlock();
+#endif
+#endif
+    }
+};
+
+/**
+   \class TBCLock
+
+   \file TBCMutex.h
+
+   \brief TBCLock lock(mutex);
+
+   Holds a TBCMutex for the lifetime of the object.
+
+   \note Should only be used as a part of TelegramBotClient
+   (https://github.com/schlingensiepen/TelegramBotClient)
+
+   \author Jörn Schlingensiepen <joern@schlingensiepen.com>
+
+*/
+class TBCLock
+{
+  private:
+    /** The mutex held */
+    TBCMutex& Mutex;
+  public:
+    /**
+        \brief Constructor, locks the mutex
+        \param mutex The mutex to hold
+    */
+    TBCLock(TBCMutex& mutex) : Mutex(mutex) {
+      Mutex.lock();
+    }
+    /**
+        \brief Destructor, unlocks the mutex
+    */
+    ~TBCLock() {
+      Mutex.unlock();
+    }
+};
+
+#endif
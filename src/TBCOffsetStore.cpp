@@ -0,0 +1,89 @@
+/**
+    \file TBCOffsetStore.cpp
+    \brief Implementation of stores persisting the update offset of
+           TelegramBotClient across restarts.
+
+    Part of TelegramBotClient (https://github.com/schlingensiepen/TelegramBotClient)
+    Jörn Schlingensiepen <joern@schlingensiepen.com>
+*/
+
+#include "TBCOffsetStore.h"
+
+#ifdef TBC_EEPROM_OFFSET_STORE
+#include <EEPROM.h>
+#endif
+#ifdef TBC_FILE_OFFSET_STORE
+#include <stdio.h>
+#endif
+
+/** Marks a valid offset in EEPROM */
+#define TBC_OFFSET_MAGIC 0x54424331L
+
+long TBCOffsetStore::begin()
+{
+  Saved = read();
+  Current = Saved;
+  LastWrite = millis();
+  DOUTKV ("Offset loaded", Saved);
+  return Saved;
+}
+
+void TBCOffsetStore::checkpoint(long offset)
+{
+  Current = offset;
+  if (MinInterval > 0 && (millis() - LastWrite) < MinInterval) return;
+  flush();
+}
+
+void TBCOffsetStore::flush()
+{
+  if (Current == Saved) return;
+  DOUTKV ("Offset saved", Current);
+  if (write(Current)) Saved = Current;
+  LastWrite = millis();
+}
+
+#ifdef TBC_EEPROM_OFFSET_STORE
+long TBCEEPROMOffsetStore::read()
+{
+  long magic = 0;
+  long offset = 0;
+  EEPROM.get(Address, magic);
+  if (magic != TBC_OFFSET_MAGIC) return 0;
+  EEPROM.get(Address + sizeof(long), offset);
+  return offset;
+}
+
+bool TBCEEPROMOffsetStore::write(long offset)
+{
+  EEPROM.put(Address, (long) TBC_OFFSET_MAGIC);
+  EEPROM.put(Address + sizeof(long), offset);
+#if defined(ESP8266) || defined(ESP32)
+  return EEPROM.commit();
+#else
+  return true;
+#endif
+}
+#endif
+
+#ifdef TBC_FILE_OFFSET_STORE
+long TBCFileOffsetStore::read()
+{
+  FILE* file = fopen(Path.c_str(), "r");
+  if (file == 0) return 0;
+  long offset = 0;
+  if (fscanf(file, "%ld", &offset) != 1) offset = 0;
+  fclose(file);
+  return offset;
+}
+
+bool TBCFileOffsetStore::write(long offset)
+{
+  String tmpPath = Path + ".tmp";
+  FILE* file = fopen(tmpPath.c_str(), "w");
+  if (file == 0) return false;
+  bool ok = fprintf(file, "%ld\n", offset) > 0;
+  ok = (fclose(file) == 0) && ok;
+  return ok && rename(tmpPath.c_str(), Path.c_str()) == 0;
+}
+#endif
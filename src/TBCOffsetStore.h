@@ -0,0 +1,180 @@
+/**
+    \file TBCOffsetStore.h
+    \brief Header of stores persisting the update offset of TelegramBotClient
+           across restarts, thus updates already processed are not
+           received again after a reboot or deep sleep.
+
+    Part of TelegramBotClient (https://github.com/schlingensiepen/TelegramBotClient)
+    Jörn Schlingensiepen <joern@schlingensiepen.com>
+*/
+#pragma once
+#ifndef TBCOffsetStore_h
+#define TBCOffsetStore_h
+
+#include "TBCDebug.h"
+#include "Arduino.h"
+
+#if defined(ESP8266) || defined(ESP32) || defined(__AVR__)
+#define TBC_EEPROM_OFFSET_STORE
+#endif
+
+#if defined(__unix__)
+#define TBC_FILE_OFFSET_STORE
+#endif
+
+/**
+   \class TBCOffsetStore
+
+   \file TBCOffsetStore.h
+
+   \brief Base class of stores persisting the update offset
+
+   The offset is the id of the next update to receive. Checkpoints are
+   coalesced: an offset is written at most once per minimum interval,
+   the latest offset is written by flush(). Implementations provide
+   read() and write() for a specific storage.
+
+   \note Should only be used as a part of TelegramBotClient
+   (https://github.com/schlingensiepen/TelegramBotClient)
+
+   \author Jörn Schlingensiepen <joern@schlingensiepen.com>
+
+*/
+class TBCOffsetStore
+{
+  private:
+    /** Offset written to the storage */
+    long Saved = 0;
+    /** Latest offset passed to checkpoint() */
+    long Current = 0;
+    /** millis() of the last write */
+    unsigned long LastWrite = 0;
+    /** Minimum time in milliseconds between two writes */
+    unsigned long MinInterval;
+  protected:
+    /**
+        \brief Reads the offset from the storage
+
+        \return The stored offset, 0 if none was stored
+    */
+    virtual long read() = 0;
+    /**
+        \brief Writes the offset to the storage
+
+        \param [in] offset The offset to store
+        \return Return true on success
+    */
+    virtual bool write(long offset) = 0;
+  public:
+    /**
+        \brief Constructor
+        \param minInterval Minimum time in milliseconds between two writes,
+        0 writes every checkpoint
+    */
+    TBCOffsetStore(unsigned long minInterval = 0) : MinInterval(minInterval) {};
+    /**
+        \brief Destructor
+    */
+    virtual ~TBCOffsetStore() {};
+    /**
+        \brief Loads the stored offset
+
+        \return The stored offset, 0 if none was stored
+    */
+    long begin();
+    /**
+        \brief Records a new offset
+
+        \param [in] offset Id of the next update to receive
+        \return Nothing
+
+        \details Writes the offset unless the last write was less than
+        the minimum interval ago.
+    */
+    void checkpoint(long offset);
+    /**
+        \brief Writes the latest offset
+
+        \return Nothing
+
+        \details Writes the offset passed to checkpoint() if it was not
+        written yet. Call it before going to deep sleep.
+    */
+    void flush();
+};
+
+#ifdef TBC_EEPROM_OFFSET_STORE
+/**
+   \class TBCEEPROMOffsetStore
+
+   \file TBCOffsetStore.h
+
+   \brief Stores the update offset in EEPROM (emulated in flash on ESP)
+
+   Uses 8 bytes starting at the given address. On ESP8266 and ESP32
+   EEPROM.begin() shall be called with a size covering these bytes
+   before TelegramBotClient::begin().
+
+   \note Should only be used as a part of TelegramBotClient
+   (https://github.com/schlingensiepen/TelegramBotClient)
+
+   \author Jörn Schlingensiepen <joern@schlingensiepen.com>
+
+*/
+class TBCEEPROMOffsetStore : public TBCOffsetStore
+{
+  private:
+    /** Address of the first byte used */
+    int Address;
+  protected:
+    long read();
+    bool write(long offset);
+  public:
+    /**
+        \brief Constructor
+        \param address Address of the first of 8 bytes used
+        \param minInterval Minimum time in milliseconds between two writes,
+        defaults to one minute to limit flash wear
+    */
+    TBCEEPROMOffsetStore(int address = 0, unsigned long minInterval = 60000)
+      : TBCOffsetStore(minInterval), Address(address) {};
+};
+#endif
+
+#ifdef TBC_FILE_OFFSET_STORE
+/**
+   \class TBCFileOffsetStore
+
+   \file TBCOffsetStore.h
+
+   \brief Stores the update offset in a file
+
+   The offset is written to a temporary file renamed to the given
+   path, so the file always contains a complete offset.
+
+   \note Should only be used as a part of TelegramBotClient
+   (https://github.com/schlingensiepen/TelegramBotClient)
+
+   \author Jörn Schlingensiepen <joern@schlingensiepen.com>
+
+*/
+class TBCFileOffsetStore : public TBCOffsetStore
+{
+  private:
+    /** Path of the file */
+    String Path;
+  protected:
+    long read();
+    bool write(long offset);
+  public:
+    /**
+        \brief Constructor
+        \param path Path of the file storing the offset
+        \param minInterval Minimum time in milliseconds between two writes
+    */
+    TBCFileOffsetStore(String path, unsigned long minInterval = 0)
+      : TBCOffsetStore(minInterval), Path(path) {};
+};
+#endif
+
+#endif
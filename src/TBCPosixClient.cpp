@@ -0,0 +1,365 @@
+/**
+    \file TBCPosixClient.cpp
+    \brief Implementation of a Client using non-blocking POSIX sockets,
+           optionally secured by OpenSSL.
+
+    Part of TelegramBotClient (https://github.com/schlingensiepen/TelegramBotClient)
+    Jörn Schlingensiepen <joern@schlingensiepen.com>
+*/
+
+#include "TBCPosixClient.h"
+
+#ifdef TBC_POSIX_CLIENT
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#ifdef MSG_NOSIGNAL
+#define TBC_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define TBC_SEND_FLAGS 0
+#endif
+
+#ifdef TBC_POSIX_OPENSSL
+SSL_CTX* TBCPosixClient::Context = 0;
+#endif
+
+TBCPosixClient::~TBCPosixClient()
+{
+  stop();
+#ifdef TBC_POSIX_OPENSSL
+  if (Ticket != 0) SSL_SESSION_free(Ticket);
+#endif
+}
+
+bool TBCPosixClient::waitFor(short events, int timeout)
+{
+  struct pollfd pfd;
+  pfd.fd = Fd;
+  pfd.events = events;
+  pfd.revents = 0;
+  int res;
+  do
+  {
+    res = ::poll(&pfd, 1, timeout);
+  } while (res < 0 && errno == EINTR);
+  return res > 0 && (pfd.revents & events) != 0;
+}
+
+int TBCPosixClient::connect(IPAddress ip, uint16_t port)
+{
+  char host[16];
+  snprintf(host, sizeof(host), "%u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+  return open(host, port, Hostname != 0 ? Hostname : host);
+}
+
+int TBCPosixClient::connect(const char* host, uint16_t port)
+{
+  return open(host, port, host);
+}
+
+int TBCPosixClient::open(const char* host, uint16_t port, const char* name)
+{
+  DOUTKV("connect", host);
+  stop();
+#ifndef TBC_POSIX_OPENSSL
+  if (Secure)
+  {
+    DOUT("TLS requires TBC_POSIX_OPENSSL");
+    return 0;
+  }
+#endif
+  struct addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  char service[6];
+  snprintf(service, sizeof(service), "%u", port);
+  struct addrinfo* addresses = 0;
+  if (getaddrinfo(host, service, &hints, &addresses) != 0)
+  {
+    DOUT("Host not resolved");
+    return 0;
+  }
+  for (struct addrinfo* address = addresses; address != 0 && Fd < 0; address = address->ai_next)
+  {
+    Fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+    if (Fd < 0) continue;
+    fcntl(Fd, F_SETFL, fcntl(Fd, F_GETFL, 0) | O_NONBLOCK);
+    int on = 1;
+    setsockopt(Fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    int res = ::connect(Fd, address->ai_addr, address->ai_addrlen);
+    if (res < 0 && errno == EINPROGRESS && waitFor(POLLOUT, TBC_POSIX_CONNECT_TIMEOUT))
+    {
+      int err = 0;
+      socklen_t length = sizeof(err);
+      getsockopt(Fd, SOL_SOCKET, SO_ERROR, &err, &length);
+      res = (err == 0) ? 0 : -1;
+    }
+    if (res < 0)
+    {
+      ::close(Fd);
+      Fd = -1;
+    }
+  }
+  freeaddrinfo(addresses);
+  if (Fd < 0)
+  {
+    DOUT("Connect failed");
+    return 0;
+  }
+  Eof = false;
+  if (Secure && !handshake(name))
+  {
+    stop();
+    return 0;
+  }
+  return 1;
+}
+
+#ifdef TBC_POSIX_OPENSSL
+int TBCPosixClient::newSession(SSL* ssl, SSL_SESSION* session)
+{
+  TBCPosixClient* client = (TBCPosixClient*) SSL_get_app_data(ssl);
+  // TLS 1.3 tickets arrive after the handshake, keep the last one as a
+  // copy, OpenSSL invalidates the session of a connection ending badly
+  if (client->Ticket != 0) SSL_SESSION_free(client->Ticket);
+  client->Ticket = SSL_SESSION_dup(session);
+  return 0;
+}
+
+SSL_SESSION* TBCPosixClient::session()
+{
+  if (Ticket == 0) return 0;
+  SSL_SESSION_up_ref(Ticket);
+  return Ticket;
+}
+#endif
+
+bool TBCPosixClient::handshake(const char* host)
+{
+#ifdef TBC_POSIX_OPENSSL
+  if (Context == 0)
+  {
+    Context = SSL_CTX_new(TLS_client_method());
+    if (Context == 0) return false;
+    SSL_CTX_set_default_verify_paths(Context);
+    SSL_CTX_set_mode(Context, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    // pass tickets to newSession(), sessions are cached by the caller
+    SSL_CTX_set_session_cache_mode(Context, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(Context, newSession);
+  }
+  Ssl = SSL_new(Context);
+  if (Ssl == 0) return false;
+  SSL_set_fd(Ssl, Fd);
+  SSL_set_app_data(Ssl, this);
+  if (Ticket != 0) SSL_SESSION_free(Ticket);
+  Ticket = 0;
+  SSL_set_tlsext_host_name(Ssl, host);
+  if (Session != 0) SSL_set_session(Ssl, Session);
+  Reused = false;
+  if (Verify)
+  {
+    SSL_set_verify(Ssl, SSL_VERIFY_PEER, 0);
+    SSL_set1_host(Ssl, host);
+  }
+  unsigned long start = millis();
+  for (;;)
+  {
+    int res = SSL_connect(Ssl);
+    if (res == 1)
+    {
+      Reused = SSL_session_reused(Ssl) == 1;
+      DOUTKV("Session reused", Reused);
+      return true;
+    }
+    int err = SSL_get_error(Ssl, res);
+    long left = TBC_POSIX_CONNECT_TIMEOUT - (long)(millis() - start);
+    if (left <= 0) break;
+    if (err == SSL_ERROR_WANT_READ && waitFor(POLLIN, left)) continue;
+    if (err == SSL_ERROR_WANT_WRITE && waitFor(POLLOUT, left)) continue;
+    break;
+  }
+  DOUT("Handshake failed");
+#else
+  // plain connections need no handshake
+  (void) host;
+#endif
+  return false;
+}
+
+int TBCPosixClient::receive(uint8_t* buffer, size_t size)
+{
+  if (Fd < 0 || Eof) return -1;
+#ifdef TBC_POSIX_OPENSSL
+  if (Ssl != 0)
+  {
+    int res = SSL_read(Ssl, buffer, size);
+    if (res > 0) return res;
+    int err = SSL_get_error(Ssl, res);
+    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) return 0;
+    Eof = true;
+    return -1;
+  }
+#endif
+  ssize_t res = ::recv(Fd, buffer, size, 0);
+  if (res > 0) return res;
+  if (res < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return 0;
+  Eof = true;
+  return -1;
+}
+
+int TBCPosixClient::transmit(const uint8_t* buffer, size_t size)
+{
+  if (Fd < 0) return -1;
+#ifdef TBC_POSIX_OPENSSL
+  if (Ssl != 0)
+  {
+    int res = SSL_write(Ssl, buffer, size);
+    if (res > 0) return res;
+    int err = SSL_get_error(Ssl, res);
+    if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) return 0;
+    return -1;
+  }
+#endif
+  ssize_t res = ::send(Fd, buffer, size, TBC_SEND_FLAGS);
+  if (res >= 0) return res;
+  if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return 0;
+  return -1;
+}
+
+void TBCPosixClient::fill()
+{
+  if (InPos < InLength) return;
+  InPos = 0;
+  InLength = 0;
+  int res = receive(In, TBC_POSIX_IN_BUFFER);
+  if (res > 0) InLength = res;
+}
+
+bool TBCPosixClient::sendPending()
+{
+  while (OutLength > 0)
+  {
+    int res = transmit(Out, OutLength);
+    if (res < 0)
+    {
+      DOUT("Send failed");
+      OutLength = 0;
+      Eof = true;
+      return false;
+    }
+    if (res == 0) return true;
+    memmove(Out, Out + res, OutLength - res);
+    OutLength -= res;
+  }
+  return true;
+}
+
+size_t TBCPosixClient::write(uint8_t value)
+{
+  return write(&value, 1);
+}
+
+size_t TBCPosixClient::write(const uint8_t* buffer, size_t size)
+{
+  if (Fd < 0 || Eof) return 0;
+  size_t written = 0;
+  while (written < size)
+  {
+    if (OutLength == TBC_POSIX_OUT_BUFFER)
+    {
+      // buffer full, the only case writing waits for the socket
+      if (!sendPending()) return written;
+      if (OutLength == TBC_POSIX_OUT_BUFFER && !waitFor(POLLOUT, TBC_POSIX_CONNECT_TIMEOUT))
+      {
+        DOUT("Send timeout");
+        return written;
+      }
+      continue;
+    }
+    size_t count = size - written;
+    if (count > TBC_POSIX_OUT_BUFFER - OutLength) count = TBC_POSIX_OUT_BUFFER - OutLength;
+    memcpy(Out + OutLength, buffer + written, count);
+    OutLength += count;
+    written += count;
+  }
+  return written;
+}
+
+int TBCPosixClient::available()
+{
+  fill();
+#ifdef TBC_POSIX_OPENSSL
+  if (Ssl != 0 && InPos == InLength && SSL_pending(Ssl) > 0) fill();
+#endif
+  return InLength - InPos;
+}
+
+int TBCPosixClient::read()
+{
+  uint8_t value;
+  return (read(&value, 1) == 1) ? value : -1;
+}
+
+int TBCPosixClient::read(uint8_t* buffer, size_t size)
+{
+  size_t count = 0;
+  while (count < size)
+  {
+    fill();
+    if (InPos == InLength) break;
+    size_t chunk = InLength - InPos;
+    if (chunk > size - count) chunk = size - count;
+    memcpy(buffer + count, In + InPos, chunk);
+    InPos += chunk;
+    count += chunk;
+  }
+  return (count == 0 && size > 0) ? -1 : (int) count;
+}
+
+int TBCPosixClient::peek()
+{
+  fill();
+  return (InPos < InLength) ? In[InPos] : -1;
+}
+
+void TBCPosixClient::flush()
+{
+  sendPending();
+}
+
+void TBCPosixClient::stop()
+{
+#ifdef TBC_POSIX_OPENSSL
+  if (Ssl != 0)
+  {
+    SSL_shutdown(Ssl);
+    SSL_free(Ssl);
+    Ssl = 0;
+  }
+#endif
+  if (Fd >= 0) ::close(Fd);
+  Fd = -1;
+  Eof = false;
+  InPos = 0;
+  InLength = 0;
+  OutLength = 0;
+}
+
+uint8_t TBCPosixClient::connected()
+{
+  if (Fd < 0) return 0;
+  // a closed connection is detected by reading
+  fill();
+  return (!Eof || InPos < InLength) ? 1 : 0;
+}
+
+#endif
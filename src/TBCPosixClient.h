@@ -0,0 +1,253 @@
+/**
+    \file TBCPosixClient.h
+    \brief Header of a Client implementation using non-blocking POSIX
+           sockets, optionally secured by OpenSSL, to run
+           TelegramBotClient on Linux gateways.
+
+    Part of TelegramBotClient (https://github.com/schlingensiepen/TelegramBotClient)
+    Jörn Schlingensiepen <joern@schlingensiepen.com>
+*/
+#pragma once
+#ifndef TBCPosixClient_h
+#define TBCPosixClient_h
+
+#include "TBCDebug.h"
+#include "Arduino.h"
+#include <Client.h>
+
+#if defined(__unix__)
+#define TBC_POSIX_CLIENT
+#endif
+
+#ifdef TBC_POSIX_CLIENT
+
+/** Define TBC_POSIX_OPENSSL and link libssl and libcrypto for https */
+#ifdef TBC_POSIX_OPENSSL
+#include <openssl/ssl.h>
+#endif
+
+/** Size of the receive buffer */
+#ifndef TBC_POSIX_IN_BUFFER
+#define TBC_POSIX_IN_BUFFER 2048
+#endif
+
+/** Size of the send buffer, writes block only if it is full */
+#ifndef TBC_POSIX_OUT_BUFFER
+#define TBC_POSIX_OUT_BUFFER 4096
+#endif
+
+/** Timeout of connecting and handshake in milliseconds */
+#ifndef TBC_POSIX_CONNECT_TIMEOUT
+#define TBC_POSIX_CONNECT_TIMEOUT 10000
+#endif
+
+/**
+   \class TBCPosixClient
+
+   \file TBCPosixClient.h
+
+   \brief TBCPosixClient sslClient(true);
+
+   Client using a non-blocking socket. Reading never waits: available()
+   reports what the socket delivers without blocking. Written data is
+   buffered and sent as the socket accepts it, the rest is sent by
+   sendPending() when the socket becomes writable. Only connecting and
+   the TLS handshake wait, at most TBC_POSIX_CONNECT_TIMEOUT.
+   The descriptor returned by fd() can be watched by epoll or poll,
+   see TBCEpollRunner.
+
+   \note Should only be used as a part of TelegramBotClient
+   (https://github.com/schlingensiepen/TelegramBotClient)
+
+   \author Jörn Schlingensiepen <joern@schlingensiepen.com>
+
+*/
+class TBCPosixClient : public Client
+{
+  private:
+    /** Socket descriptor, -1 if not connected */
+    int Fd = -1;
+    /** Use TLS */
+    bool Secure;
+    /** Verify the certificate of the server */
+    bool Verify = true;
+    /** Indicates the server closed the connection */
+    bool Eof = false;
+    /** Name of the host sent as SNI when connecting by address, not copied */
+    const char* Hostname = 0;
+#ifdef TBC_POSIX_OPENSSL
+    /** TLS connection */
+    SSL* Ssl = 0;
+    /** TLS context shared by all clients */
+    static SSL_CTX* Context;
+    /** Session offered by the next handshake, not owned */
+    SSL_SESSION* Session = 0;
+    /** Indicates the last handshake resumed Session */
+    bool Reused = false;
+    /** Last resumable session received from the server, owned */
+    SSL_SESSION* Ticket = 0;
+    /**
+        \brief Called by OpenSSL when the server sent a resumable session
+
+        \param [in] ssl The connection
+        \param [in] session The session
+        \return 0, a copy of session is kept
+    */
+    static int newSession(SSL* ssl, SSL_SESSION* session);
+#endif
+    /** Receive buffer */
+    uint8_t In[TBC_POSIX_IN_BUFFER];
+    /** Position of the next byte in In */
+    size_t InPos = 0;
+    /** Number of bytes in In */
+    size_t InLength = 0;
+    /** Send buffer */
+    uint8_t Out[TBC_POSIX_OUT_BUFFER];
+    /** Number of bytes in Out */
+    size_t OutLength = 0;
+    /**
+        \brief Waits for the socket
+
+        \param [in] events Events as used by poll()
+        \param [in] timeout Timeout in milliseconds
+        \return True if one of the events occurred
+    */
+    bool waitFor(short events, int timeout);
+    /**
+        \brief Reads from the socket without blocking
+
+        \return Number of bytes read, 0 if no data is ready, -1 if closed
+    */
+    int receive(uint8_t* buffer, size_t size);
+    /**
+        \brief Writes to the socket without blocking
+
+        \return Number of bytes written, 0 if the socket is busy, -1 on error
+    */
+    int transmit(const uint8_t* buffer, size_t size);
+    /**
+        \brief Refills the receive buffer without blocking
+
+        \return Nothing
+    */
+    void fill();
+    /**
+        \brief Performs the TLS handshake
+
+        \param [in] host Name of the host used for SNI and verification
+        \return True on success
+    */
+    bool handshake(const char* host);
+    /**
+        \brief Connects the socket and performs the TLS handshake
+
+        \param [in] host Name or address of the host
+        \param [in] port Port to connect to
+        \param [in] name Name of the host used for SNI and verification
+        \return 1 on success, 0 on failure
+    */
+    int open(const char* host, uint16_t port, const char* name);
+
+  public:
+    /**
+        \brief Constructor
+        \param secure Optional. Use TLS, requires TBC_POSIX_OPENSSL
+    */
+    TBCPosixClient(bool secure = true) : Secure(secure) {};
+    /**
+        \brief Destructor, closes the connection
+    */
+    ~TBCPosixClient();
+    int connect(IPAddress ip, uint16_t port);
+    int connect(const char* host, uint16_t port);
+    size_t write(uint8_t value);
+    size_t write(const uint8_t* buffer, size_t size);
+    using Print::write;
+    int available();
+    int read();
+    int read(uint8_t* buffer, size_t size);
+    int peek();
+    /**
+        \brief Sends buffered data
+
+        \details Does not wait for the socket, data the socket does not
+        accept is sent by sendPending().
+    */
+    void flush();
+    void stop();
+    uint8_t connected();
+    operator bool() {
+      return Fd >= 0;
+    }
+    /**
+        \brief Socket descriptor
+
+        \return The descriptor, -1 if not connected
+    */
+    int fd() {
+      return Fd;
+    }
+    /**
+        \brief Checks for buffered data
+
+        \return True if data waits for the socket to become writable
+    */
+    bool wantsWrite() {
+      return OutLength > 0;
+    }
+    /**
+        \brief Sends buffered data without blocking
+
+        \return False if the connection failed
+    */
+    bool sendPending();
+    /**
+        \brief Enables the verification of the server certificate
+
+        \param [in] verify False to accept any certificate, for tests only
+        \return Nothing
+    */
+    void setVerify(bool verify) {
+      Verify = verify;
+    }
+    /**
+        \brief Sets the name of the host used when connecting by address
+
+        \param [in] hostname Name sent as SNI and verified, has to
+        outlive the client, 0 to use the address
+        \return Nothing
+    */
+    void setHostname(const char* hostname) {
+      Hostname = hostname;
+    }
+#ifdef TBC_POSIX_OPENSSL
+    /**
+        \brief Sets the TLS session offered by the next handshake
+
+        \param [in] session Session to resume, 0 for a full handshake,
+        the caller keeps its reference
+        \return Nothing
+    */
+    void setSession(SSL_SESSION* session) {
+      Session = session;
+    }
+    /**
+        \brief TLS session of the connection
+
+        \return New reference to the last resumable session received,
+        to be freed by SSL_SESSION_free(), 0 if none was received
+    */
+    SSL_SESSION* session();
+    /**
+        \brief Indicates the last handshake resumed a session
+
+        \return True if the session offered was resumed
+    */
+    bool sessionReused() {
+      return Reused;
+    }
+#endif
+};
+
+#endif
+#endif
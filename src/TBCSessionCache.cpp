@@ -0,0 +1,99 @@
+/**
+    \file TBCSessionCache.cpp
+    \brief Implementation of a TLS session cache shared by the
+           connections of TelegramBotClient.
+
+    Part of TelegramBotClient (https://github.com/schlingensiepen/TelegramBotClient)
+    Jörn Schlingensiepen <joern@schlingensiepen.com>
+*/
+
+#include "TBCSessionCache.h"
+
+#ifdef TBC_SESSION_CACHE
+
+bool TBCSessionCache::add(TBCSessionClient& client)
+{
+  if (ClientCount >= TBC_SESSION_CLIENTS) return false;
+  Clients[ClientCount++] = &client;
+  return true;
+}
+
+TBCSessionClient* TBCSessionCache::find(Client* client)
+{
+  for (uint8_t i = 0; i < ClientCount; i++)
+  {
+    if (Clients[i] == client) return Clients[i];
+  }
+  return 0;
+}
+
+#if defined(ESP8266)
+
+TBCSessionCache::~TBCSessionCache()
+{
+}
+
+void TBCSessionCache::event(JwcConnectionEvent event, Client* client)
+{
+  TBCSessionClient* secureClient = find(client);
+  if (secureClient == 0) return;
+  // BearSSL stores the session of every handshake in the session set
+  if (event == JwcConnectionEvent::BeforeConnect) secureClient->setSession(&Session);
+}
+
+void TBCSessionCache::clear()
+{
+  Session = BearSSL::Session();
+}
+
+#else
+
+TBCSessionCache::~TBCSessionCache()
+{
+  clear();
+}
+
+void TBCSessionCache::keep(TBCSessionClient* client)
+{
+  SSL_SESSION* session = client->session();
+  if (session == 0) return;
+  if (session == Session || !SSL_SESSION_is_resumable(session))
+  {
+    SSL_SESSION_free(session);
+    return;
+  }
+  // replaced sessions stay valid for clients still using them
+  if (Session != 0) SSL_SESSION_free(Session);
+  Session = session;
+}
+
+void TBCSessionCache::event(JwcConnectionEvent event, Client* client)
+{
+  TBCSessionClient* posixClient = find(client);
+  if (posixClient == 0) return;
+  switch (event)
+  {
+    case JwcConnectionEvent::BeforeConnect:
+      posixClient->setSession(Session);
+      break;
+    case JwcConnectionEvent::AfterConnect:
+      if (posixClient->sessionReused()) Resumed++;
+      DOUTKV("Resumed", Resumed);
+      keep(posixClient);
+      break;
+    case JwcConnectionEvent::BeforeClose:
+      // TLS 1.3 tickets arrive after the handshake
+      keep(posixClient);
+      break;
+  }
+}
+
+void TBCSessionCache::clear()
+{
+  if (Session != 0) SSL_SESSION_free(Session);
+  Session = 0;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,141 @@
+/**
+    \file TBCSessionCache.h
+    \brief Header of a TLS session cache shared by the connections of
+           TelegramBotClient to resume sessions instead of full handshakes.
+
+    Part of TelegramBotClient (https://github.com/schlingensiepen/TelegramBotClient)
+    Jörn Schlingensiepen <joern@schlingensiepen.com>
+*/
+#pragma once
+#ifndef TBCSessionCache_h
+#define TBCSessionCache_h
+
+#include "TBCDebug.h"
+#include "Arduino.h"
+#include "JsonWebClient.h"
+
+#if defined(ESP8266)
+#include <WiFiClientSecure.h>
+#define TBC_SESSION_CACHE
+#elif defined(TBC_POSIX_OPENSSL)
+#include "TBCPosixClient.h"
+#define TBC_SESSION_CACHE
+#endif
+
+#ifdef TBC_SESSION_CACHE
+
+/** Number of clients sharing the sessions */
+#ifndef TBC_SESSION_CLIENTS
+#define TBC_SESSION_CLIENTS 2
+#endif
+
+#if defined(ESP8266)
+/** Client able to resume sessions */
+typedef BearSSL::WiFiClientSecure TBCSessionClient;
+#else
+/** Client able to resume sessions */
+typedef TBCPosixClient TBCSessionClient;
+#endif
+
+/**
+   \class TBCSessionCache
+
+   \file TBCSessionCache.h
+
+   \brief TBCSessionCache sessions; sessions.add(sslClient); client.setConnectionHook(sessions.hook());
+
+   Keeps the TLS session of the last handshake and offers it to the
+   next connect, so reconnects of the poll and the post connection
+   resume the session instead of a full handshake. Only clients
+   registered by add() take part, these are TBCSessionClient, i.e.
+   BearSSL::WiFiClientSecure on ESP8266 or TBCPosixClient with
+   TBC_POSIX_OPENSSL on Linux. Other clients passing the hook, e.g. a
+   plain WiFiClient, are ignored. The client of ESP32 has no API to
+   resume sessions.
+
+   \note Should only be used as a part of TelegramBotClient
+   (https://github.com/schlingensiepen/TelegramBotClient)
+
+   \author Jörn Schlingensiepen <joern@schlingensiepen.com>
+
+*/
+class TBCSessionCache
+{
+  private:
+    /** Clients sharing the sessions */
+    TBCSessionClient* Clients[TBC_SESSION_CLIENTS];
+    /** Number of clients in Clients */
+    uint8_t ClientCount = 0;
+    /**
+        \brief Finds a registered client
+
+        \param [in] client Client passed to the hook
+        \return The client, 0 if it was not registered by add()
+    */
+    TBCSessionClient* find(Client* client);
+#if defined(ESP8266)
+    /** Session updated by every handshake of the clients */
+    BearSSL::Session Session;
+#else
+    /** Session of the last handshake, 0 if none */
+    SSL_SESSION* Session = 0;
+    /** Number of handshakes resuming Session */
+    unsigned long Resumed = 0;
+    /**
+        \brief Keeps the session of a client if it can be resumed
+
+        \param [in] client The client
+        \return Nothing
+    */
+    void keep(TBCSessionClient* client);
+#endif
+    /**
+        \brief Called by the clients at the stages of a connection
+
+        \param [in] event The stage
+        \param [in] client The client
+        \return Nothing
+    */
+    void event(JwcConnectionEvent event, Client* client);
+
+  public:
+    /**
+        \brief Destructor, releases the session
+    */
+    ~TBCSessionCache();
+    /**
+        \brief Registers a client sharing the sessions
+
+        \param [in] client The client, has to outlive the cache
+        \return False if TBC_SESSION_CLIENTS clients are registered already
+    */
+    bool add(TBCSessionClient& client);
+    /**
+        \brief Hook to be set for the clients sharing the sessions
+
+        \return Hook for JsonWebClient::setConnectionHook() or
+        TelegramBotClient::setConnectionHook()
+    */
+    JwcConnectionHook hook() {
+      return JwcConnectionHook(this, &TBCSessionCache::event);
+    }
+    /**
+        \brief Forgets the session, the next connect does a full handshake
+
+        \return Nothing
+    */
+    void clear();
+#if !defined(ESP8266)
+    /**
+        \brief Number of handshakes that resumed a session
+
+        \return Number of resumed handshakes
+    */
+    unsigned long resumed() {
+      return Resumed;
+    }
+#endif
+};
+
+#endif
+#endif
@@ -0,0 +1,306 @@
+/**
+    \file TBCSpool.cpp
+    \brief Implementation of a bounded spool storing the outgoing
+           messages of TelegramBotClient while the connection is down.
+
+    Part of TelegramBotClient (https://github.com/schlingensiepen/TelegramBotClient)
+    Jörn Schlingensiepen <joern@schlingensiepen.com>
+*/
+
+#include "TBCSpool.h"
+
+#ifdef TBC_EEPROM_SPOOL
+#include <EEPROM.h>
+#endif
+#ifdef TBC_FILE_SPOOL
+#include <stdio.h>
+#endif
+
+/** Marks a valid spool in EEPROM */
+#define TBC_SPOOL_MAGIC 0x54425331L
+
+/** Flag of the first byte of a message posted at least once */
+#define TBC_SPOOL_AT_LEAST_ONCE 0x80
+
+/** Maximum length of a varint in bytes */
+#define TBC_SPOOL_VARINT ((sizeof(unsigned long) * 8 + 6) / 7)
+
+/**
+    \brief Encodes a number in 7 bit groups
+
+    \param [out] out Buffer of TBC_SPOOL_VARINT bytes
+    \param [in] value The number
+    \return Number of bytes written
+*/
+static size_t putVarint(uint8_t* out, unsigned long value)
+{
+  size_t length = 0;
+  while (value >= 0x80)
+  {
+    out[length++] = (uint8_t) (value | 0x80);
+    value >>= 7;
+  }
+  out[length++] = (uint8_t) value;
+  return length;
+}
+
+/**
+    \brief Decodes a number written by putVarint()
+
+    \param [in] in Encoded number
+    \param [in] length Number of bytes available
+    \param [out] value The number
+    \return Number of bytes read, 0 if the number is incomplete
+*/
+static size_t getVarint(const uint8_t* in, size_t length, unsigned long& value)
+{
+  value = 0;
+  for (size_t i = 0; i < length && i < TBC_SPOOL_VARINT; i++)
+  {
+    value |= (unsigned long) (in[i] & 0x7f) << (7 * i);
+    if ((in[i] & 0x80) == 0) return i + 1;
+  }
+  return 0;
+}
+
+size_t TBCSpool::parse(size_t offset, long& chatId, TBCPriority& priority, TBCDelivery& delivery,
+                       size_t& head, size_t& textLength, size_t& keyBoardLength)
+{
+  if (offset >= Used
+      || (Data[offset] & ~TBC_SPOOL_AT_LEAST_ONCE) > (uint8_t) TBCPriority::Chatter) return 0;
+  priority = (TBCPriority) (Data[offset] & ~TBC_SPOOL_AT_LEAST_ONCE);
+  delivery = (Data[offset] & TBC_SPOOL_AT_LEAST_ONCE)
+             ? TBCDelivery::AtLeastOnce : TBCDelivery::AtMostOnce;
+  head = 1;
+  unsigned long values[3];
+  for (uint8_t i = 0; i < 3; i++)
+  {
+    size_t length = getVarint(Data + offset + head, Used - offset - head, values[i]);
+    if (length == 0) return 0;
+    head += length;
+  }
+  // zigzag encoded, small negative ids of groups stay short
+  chatId = (values[0] & 1) ? (long) ~(values[0] >> 1) : (long) (values[0] >> 1);
+  textLength = values[1];
+  keyBoardLength = values[2];
+  if (textLength > Used || keyBoardLength > Used
+      || head + textLength + keyBoardLength > Used - offset) return 0;
+  return head + textLength + keyBoardLength;
+}
+
+uint TBCSpool::begin()
+{
+  Used = read(Data);
+  if (Used > TBC_SPOOL_SIZE) Used = 0;
+  Count = 0;
+  size_t offset = 0;
+  long chatId;
+  TBCPriority priority;
+  TBCDelivery delivery;
+  size_t head, textLength, keyBoardLength;
+  while (offset < Used)
+  {
+    size_t length = parse(offset, chatId, priority, delivery, head, textLength, keyBoardLength);
+    if (length == 0) break;
+    offset += length;
+    Count++;
+  }
+  if (offset < Used)
+  {
+    DOUT("Spool corrupt, tail dropped");
+    Used = offset;
+  }
+  LastWrite = millis();
+  DOUTKV("Spool loaded", Count);
+  return Count;
+}
+
+size_t TBCSpool::victim(long chatId, TBCPriority priority)
+{
+  size_t found = Used;
+  // messages of higher classes are not dropped for the new one
+  int lowest = (int) priority - 1;
+  size_t offset = 0;
+  long id;
+  TBCPriority current;
+  TBCDelivery guarantee;
+  size_t head, textLength, keyBoardLength;
+  while (offset < Used)
+  {
+    size_t length = parse(offset, id, current, guarantee, head, textLength, keyBoardLength);
+    if (length == 0) break;
+    if (Overflow == TBCSpoolOverflow::CoalesceChat
+        && id == chatId && current >= priority) return offset;
+    if ((int) current > lowest)
+    {
+      lowest = (int) current;
+      found = offset;
+    }
+    offset += length;
+  }
+  return found;
+}
+
+void TBCSpool::remove(size_t offset)
+{
+  long chatId;
+  TBCPriority priority;
+  TBCDelivery delivery;
+  size_t head, textLength, keyBoardLength;
+  size_t length = parse(offset, chatId, priority, delivery, head, textLength, keyBoardLength);
+  if (length == 0) return;
+  memmove(Data + offset, Data + offset + length, Used - offset - length);
+  Used -= length;
+  Count--;
+}
+
+bool TBCSpool::push(long chatId, const String& text, const String& keyBoard,
+                    TBCPriority priority, TBCDelivery delivery, bool front)
+{
+  uint8_t head[1 + 3 * TBC_SPOOL_VARINT];
+  size_t headLength = 0;
+  head[headLength++] = (uint8_t) priority
+                       | (delivery == TBCDelivery::AtLeastOnce ? TBC_SPOOL_AT_LEAST_ONCE : 0);
+  unsigned long zigzag = (chatId < 0)
+                         ? ((unsigned long) ~chatId << 1) | 1
+                         : (unsigned long) chatId << 1;
+  headLength += putVarint(head + headLength, zigzag);
+  headLength += putVarint(head + headLength, text.length());
+  headLength += putVarint(head + headLength, keyBoard.length());
+  size_t length = headLength + text.length() + keyBoard.length();
+  if (length > TBC_SPOOL_SIZE)
+  {
+    DOUT("Message too long for the spool");
+    Dropped++;
+    return false;
+  }
+  while (Used + length > TBC_SPOOL_SIZE)
+  {
+    size_t offset = (Overflow == TBCSpoolOverflow::DropNewest) ? Used : victim(chatId, priority);
+    if (offset >= Used)
+    {
+      DOUT("Spool full, message dropped");
+      Dropped++;
+      return false;
+    }
+    DOUT("Spool full, spooled message dropped");
+    remove(offset);
+    Dropped++;
+  }
+  size_t offset = front ? 0 : Used;
+  memmove(Data + offset + length, Data + offset, Used - offset);
+  memcpy(Data + offset, head, headLength);
+  memcpy(Data + offset + headLength, text.c_str(), text.length());
+  memcpy(Data + offset + headLength + text.length(), keyBoard.c_str(), keyBoard.length());
+  Used += length;
+  Count++;
+  DOUTKV("Spooled", Count);
+  changed();
+  return true;
+}
+
+bool TBCSpool::shift(long& chatId, String& text, String& keyBoard,
+                     TBCPriority& priority, TBCDelivery& delivery)
+{
+  size_t found = Used;
+  size_t offset = 0;
+  long id;
+  TBCPriority current;
+  TBCDelivery guarantee;
+  size_t head, textLength, keyBoardLength;
+  while (offset < Used)
+  {
+    size_t length = parse(offset, id, current, guarantee, head, textLength, keyBoardLength);
+    if (length == 0) break;
+    if (found == Used || current < priority)
+    {
+      found = offset;
+      chatId = id;
+      priority = current;
+      delivery = guarantee;
+      if (priority == TBCPriority::Alarm) break;
+    }
+    offset += length;
+  }
+  if (found == Used) return false;
+  parse(found, id, current, guarantee, head, textLength, keyBoardLength);
+  const char* data = (const char*) Data + found + head;
+  text = String();
+  text.reserve(textLength);
+  for (size_t i = 0; i < textLength; i++) text += data[i];
+  data += textLength;
+  keyBoard = String();
+  keyBoard.reserve(keyBoardLength);
+  for (size_t i = 0; i < keyBoardLength; i++) keyBoard += data[i];
+  remove(found);
+  DOUTKV("Unspooled", Count);
+  Dirty = true;
+  // a drained spool is written at once, its messages are not sent twice
+  if (Count == 0) flush();
+  else changed();
+  return true;
+}
+
+void TBCSpool::changed()
+{
+  Dirty = true;
+  if (MinInterval > 0 && (millis() - LastWrite) < MinInterval) return;
+  flush();
+}
+
+void TBCSpool::flush()
+{
+  if (!Dirty) return;
+  DOUTKV ("Spool saved", Used);
+  if (write(Data, Used)) Dirty = false;
+  LastWrite = millis();
+}
+
+#ifdef TBC_EEPROM_SPOOL
+size_t TBCEEPROMSpool::read(uint8_t* data)
+{
+  long magic = 0;
+  uint16_t length = 0;
+  EEPROM.get(Address, magic);
+  if (magic != TBC_SPOOL_MAGIC) return 0;
+  EEPROM.get(Address + sizeof(long), length);
+  if (length > TBC_SPOOL_SIZE) return 0;
+  int address = Address + sizeof(long) + sizeof(length);
+  for (uint16_t i = 0; i < length; i++) data[i] = EEPROM.read(address + i);
+  return length;
+}
+
+bool TBCEEPROMSpool::write(const uint8_t* data, size_t length)
+{
+  EEPROM.put(Address, (long) TBC_SPOOL_MAGIC);
+  EEPROM.put(Address + sizeof(long), (uint16_t) length);
+  int address = Address + sizeof(long) + sizeof(uint16_t);
+  for (size_t i = 0; i < length; i++) EEPROM.write(address + i, data[i]);
+#if defined(ESP8266) || defined(ESP32)
+  return EEPROM.commit();
+#else
+  return true;
+#endif
+}
+#endif
+
+#ifdef TBC_FILE_SPOOL
+size_t TBCFileSpool::read(uint8_t* data)
+{
+  FILE* file = fopen(Path.c_str(), "rb");
+  if (file == 0) return 0;
+  size_t length = fread(data, 1, TBC_SPOOL_SIZE, file);
+  fclose(file);
+  return length;
+}
+
+bool TBCFileSpool::write(const uint8_t* data, size_t length)
+{
+  String tmpPath = Path + ".tmp";
+  FILE* file = fopen(tmpPath.c_str(), "wb");
+  if (file == 0) return false;
+  bool ok = fwrite(data, 1, length, file) == length;
+  ok = (fclose(file) == 0) && ok;
+  return ok && rename(tmpPath.c_str(), Path.c_str()) == 0;
+}
+#endif
@@ -0,0 +1,325 @@
+/**
+    \file TBCSpool.h
+    \brief Header of a bounded spool storing the outgoing messages of
+           TelegramBotClient while the connection is down, optionally
+           persisted in EEPROM or a file.
+
+    Part of TelegramBotClient (https://github.com/schlingensiepen/TelegramBotClient)
+    Jörn Schlingensiepen <joern@schlingensiepen.com>
+*/
+#pragma once
+#ifndef TBCSpool_h
+#define TBCSpool_h
+
+#include "TBCDebug.h"
+#include "Arduino.h"
+#include "TelegramBotClient.h"
+
+/** Bytes of messages spooled */
+#ifndef TBC_SPOOL_SIZE
+#ifdef ESP8266
+#define TBC_SPOOL_SIZE 512
+#else
+#define TBC_SPOOL_SIZE 2048
+#endif
+#endif
+
+#if defined(ESP8266) || defined(ESP32) || defined(__AVR__)
+#define TBC_EEPROM_SPOOL
+#endif
+
+#if defined(__unix__)
+#define TBC_FILE_SPOOL
+#endif
+
+/**
+   \class TBCSpoolOverflow
+   @enum mapper::TBCSpoolOverflow
+
+   \file TBCSpool.h
+
+   \brief TBCSpoolOverflow overflow = TBCSpoolOverflow::DropOldest;
+
+   Enumeration of the messages dropped if the spool is full.
+
+   \note Should only be used as a part of TelegramBotClient
+   (https://github.com/schlingensiepen/TelegramBotClient)
+
+   \author Jörn Schlingensiepen <joern@schlingensiepen.com>
+
+*/
+enum class TBCSpoolOverflow : int
+{
+  /** Drops the oldest message of the lowest class, but none of a
+      class higher than the new message */
+  DropOldest = 0,
+  /** Drops the new message */
+  DropNewest = 1,
+  /** Drops the oldest message of the chat of the new message not of
+      a higher class, thus every chat keeps its latest messages, falls
+      back to DropOldest if the chat has no such message spooled */
+  CoalesceChat = 2
+};
+
+/**
+   \class TBCSpool
+
+   \file TBCSpool.h
+
+   \brief TBCSpool spool; client.setSpool(&spool);
+
+   Stores messages TelegramBotClient can not post, because the outbox
+   is full or the connection is down, in TBC_SPOOL_SIZE bytes. Each
+   message takes its text and keyboard plus 4 to 12 bytes. The
+   messages are posted again in order of their class as fast as the
+   post interval allows once the connection is back. Implementations
+   of read() and write() persist the spool, writes are coalesced like
+   the ones of TBCOffsetStore.
+
+   \note Should only be used as a part of TelegramBotClient
+   (https://github.com/schlingensiepen/TelegramBotClient)
+
+   \author Jörn Schlingensiepen <joern@schlingensiepen.com>
+
+*/
+class TBCSpool
+{
+  private:
+    /** Spooled messages, oldest first */
+    uint8_t Data[TBC_SPOOL_SIZE];
+    /** Number of bytes used in Data */
+    size_t Used = 0;
+    /** Number of messages spooled */
+    uint Count = 0;
+    /** Messages dropped if the spool is full */
+    TBCSpoolOverflow Overflow;
+    /** Number of messages dropped */
+    unsigned long Dropped = 0;
+    /** Indicates changes not written yet */
+    bool Dirty = false;
+    /** millis() of the last write */
+    unsigned long LastWrite = 0;
+    /** Minimum time in milliseconds between two writes */
+    unsigned long MinInterval;
+    /**
+        \brief Decodes the head of a message
+
+        \param [in] offset Offset of the message in Data
+        \param [out] chatId Id of the chat
+        \param [out] priority Class of the message
+        \param [out] delivery Guarantee of the message
+        \param [out] head Length of the head in bytes
+        \param [out] textLength Length of the text in bytes
+        \param [out] keyBoardLength Length of the keyboard in bytes
+        \return Length of the message in bytes, 0 if it is corrupt
+    */
+    size_t parse(size_t offset, long& chatId, TBCPriority& priority, TBCDelivery& delivery,
+                 size_t& head, size_t& textLength, size_t& keyBoardLength);
+    /**
+        \brief Finds the message to drop if the spool is full
+
+        \param [in] chatId Id of the chat of the new message
+        \param [in] priority Class of the new message
+        \return Offset of the message in Data, Used if none
+    */
+    size_t victim(long chatId, TBCPriority priority);
+    /**
+        \brief Removes a message
+
+        \param [in] offset Offset of the message in Data
+        \return Nothing
+    */
+    void remove(size_t offset);
+    /**
+        \brief Writes the spool unless the last write is too recent
+
+        \return Nothing
+    */
+    void changed();
+  protected:
+    /**
+        \brief Reads the spool from the storage
+
+        \param [out] data Buffer of TBC_SPOOL_SIZE bytes
+        \return Number of bytes read, 0 if none were stored
+    */
+    virtual size_t read(uint8_t* data) {
+      return 0;
+    }
+    /**
+        \brief Writes the spool to the storage
+
+        \param [in] data Spooled messages
+        \param [in] length Number of bytes
+        \return Return true on success
+    */
+    virtual bool write(const uint8_t* data, size_t length) {
+      return true;
+    }
+  public:
+    /**
+        \brief Constructor
+        \param overflow Messages dropped if the spool is full
+        \param minInterval Minimum time in milliseconds between two writes,
+        0 writes every change
+    */
+    TBCSpool(TBCSpoolOverflow overflow = TBCSpoolOverflow::DropOldest,
+             unsigned long minInterval = 0)
+      : Overflow(overflow), MinInterval(minInterval) {};
+    /**
+        \brief Destructor
+    */
+    virtual ~TBCSpool() {};
+    /**
+        \brief Loads the stored messages
+
+        \return Number of messages loaded
+
+        \details Called by TelegramBotClient::begin(), a corrupt tail
+        of the storage is dropped.
+    */
+    uint begin();
+    /**
+        \brief Stores a message
+
+        \param [in] chatId Id of the chat the message shall be sent to
+        \param [in] text Text of the message
+        \param [in] keyBoard Json members describing the keyboard
+        \param [in] priority Class the message is posted in
+        \param [in] delivery Guarantee if the post is not answered
+        \param [in] front True to store it as the oldest message,
+        used for messages taken back from the outbox
+        \return Returns false if the message was dropped
+    */
+    bool push(long chatId, const String& text, const String& keyBoard,
+              TBCPriority priority, TBCDelivery delivery, bool front = false);
+    /**
+        \brief Takes the oldest message of the highest class
+
+        \param [out] chatId Id of the chat the message shall be sent to
+        \param [out] text Text of the message
+        \param [out] keyBoard Json members describing the keyboard
+        \param [out] priority Class the message is posted in
+        \param [out] delivery Guarantee if the post is not answered
+        \return Returns false if the spool is empty
+    */
+    bool shift(long& chatId, String& text, String& keyBoard,
+               TBCPriority& priority, TBCDelivery& delivery);
+    /**
+        \brief Writes the latest changes
+
+        \return Nothing
+
+        \details Written by the next change once the minimum interval
+        passed and when the spool was drained. Call it before going
+        to deep sleep.
+    */
+    void flush();
+    /**
+        \brief Number of messages spooled
+
+        \return Number of messages
+    */
+    uint count() {
+      return Count;
+    }
+    /**
+        \brief Number of bytes used
+
+        \return Number of bytes, at most TBC_SPOOL_SIZE
+    */
+    size_t used() {
+      return Used;
+    }
+    /**
+        \brief Number of messages dropped because the spool was full
+
+        \return Number of dropped messages
+    */
+    unsigned long dropped() {
+      return Dropped;
+    }
+};
+
+#ifdef TBC_EEPROM_SPOOL
+/**
+   \class TBCEEPROMSpool
+
+   \file TBCSpool.h
+
+   \brief Persists the spool in EEPROM (emulated in flash on ESP)
+
+   Uses TBC_SPOOL_SIZE + 6 bytes starting at the given address. On
+   ESP8266 and ESP32 EEPROM.begin() shall be called with a size covering
+   these bytes before TelegramBotClient::begin().
+
+   \note Should only be used as a part of TelegramBotClient
+   (https://github.com/schlingensiepen/TelegramBotClient)
+
+   \author Jörn Schlingensiepen <joern@schlingensiepen.com>
+
+*/
+class TBCEEPROMSpool : public TBCSpool
+{
+  private:
+    /** Address of the first byte used */
+    int Address;
+  protected:
+    size_t read(uint8_t* data);
+    bool write(const uint8_t* data, size_t length);
+  public:
+    /**
+        \brief Constructor
+        \param address Address of the first byte used, defaults to
+        the first byte behind a TBCEEPROMOffsetStore at address 0
+        \param overflow Messages dropped if the spool is full
+        \param minInterval Minimum time in milliseconds between two writes,
+        defaults to one minute to limit flash wear
+    */
+    TBCEEPROMSpool(int address = 8,
+                   TBCSpoolOverflow overflow = TBCSpoolOverflow::DropOldest,
+                   unsigned long minInterval = 60000)
+      : TBCSpool(overflow, minInterval), Address(address) {};
+};
+#endif
+
+#ifdef TBC_FILE_SPOOL
+/**
+   \class TBCFileSpool
+
+   \file TBCSpool.h
+
+   \brief Persists the spool in a file
+
+   The spool is written to a temporary file renamed to the given
+   path, so the file always contains complete messages.
+
+   \note Should only be used as a part of TelegramBotClient
+   (https://github.com/schlingensiepen/TelegramBotClient)
+
+   \author Jörn Schlingensiepen <joern@schlingensiepen.com>
+
+*/
+class TBCFileSpool : public TBCSpool
+{
+  private:
+    /** Path of the file */
+    String Path;
+  protected:
+    size_t read(uint8_t* data);
+    bool write(const uint8_t* data, size_t length);
+  public:
+    /**
+        \brief Constructor
+        \param path Path of the file storing the spool
+        \param overflow Messages dropped if the spool is full
+        \param minInterval Minimum time in milliseconds between two writes
+    */
+    TBCFileSpool(String path,
+                 TBCSpoolOverflow overflow = TBCSpoolOverflow::DropOldest,
+                 unsigned long minInterval = 0)
+      : TBCSpool(overflow, minInterval), Path(path) {};
+};
+#endif
+
+#endif
@@ -0,0 +1,388 @@
+/**
+    \file TBCTrace.cpp
+    \brief Implementation of Client decorators recording and replaying
+           the byte timeline of a connection.
+
+    Part of TelegramBotClient (https://github.com/schlingensiepen/TelegramBotClient)
+    Jörn Schlingensiepen <joern@schlingensiepen.com>
+*/
+
+#include "TBCTrace.h"
+
+TBCRecordClient::TBCRecordClient(Client& inner, Print& sink)
+{
+  DOUT("New TBCRecordClient");
+  this->Inner = &inner;
+  this->Sink = &sink;
+  this->Last = micros();
+}
+
+TBCRecordClient::~TBCRecordClient()
+{
+  end();
+}
+
+void TBCRecordClient::putVarint(unsigned long value)
+{
+  uint8_t buffer[5];
+  size_t length = 0;
+  while (value >= 0x80)
+  {
+    buffer[length++] = (uint8_t) (value | 0x80);
+    value >>= 7;
+  }
+  buffer[length++] = (uint8_t) value;
+  Sink->write(buffer, length);
+}
+
+void TBCRecordClient::putRecord(TBCTraceRecord type, unsigned long time,
+                                const uint8_t* data, size_t length)
+{
+  if (!Started)
+  {
+    Sink->write((const uint8_t*) TBC_TRACE_MAGIC, 4);
+    Started = true;
+  }
+  Sink->write((uint8_t) type);
+  putVarint(time - Last);
+  Last = time;
+  putVarint(length);
+  if (length > 0) Sink->write(data, length);
+}
+
+void TBCRecordClient::collect(TBCTraceRecord type, const uint8_t* data, size_t length)
+{
+  if (RunLength > 0
+      && (type != RunType || micros() - RunStart > TBC_TRACE_MERGE_MICROS))
+    end();
+  while (length > 0)
+  {
+    if (RunLength == 0)
+    {
+      RunType = type;
+      RunStart = micros();
+    }
+    size_t count = TBC_TRACE_RUN - RunLength;
+    if (count > length) count = length;
+    memcpy(Run + RunLength, data, count);
+    RunLength += count;
+    data += count;
+    length -= count;
+    if (RunLength == TBC_TRACE_RUN) end();
+  }
+}
+
+void TBCRecordClient::end()
+{
+  if (RunLength == 0) return;
+  putRecord(RunType, RunStart, Run, RunLength);
+  RunLength = 0;
+}
+
+void TBCRecordClient::checkEof()
+{
+  if (!Open || Inner->connected() || Inner->available() > 0) return;
+  end();
+  putRecord(TBCTraceRecord::Eof, micros(), 0, 0);
+  Open = false;
+}
+
+int TBCRecordClient::connect(IPAddress ip, uint16_t port)
+{
+  end();
+  int result = Inner->connect(ip, port);
+  uint8_t data[3] = { (uint8_t) result, (uint8_t) port, (uint8_t) (port >> 8) };
+  putRecord(TBCTraceRecord::Connect, micros(), data, 3);
+  Open = result == 1;
+  return result;
+}
+
+int TBCRecordClient::connect(const char* host, uint16_t port)
+{
+  end();
+  int result = Inner->connect(host, port);
+  // Run is empty after end(), use it to assemble the data
+  size_t length = strlen(host);
+  if (length > TBC_TRACE_RUN - 3) length = TBC_TRACE_RUN - 3;
+  Run[0] = (uint8_t) result;
+  Run[1] = (uint8_t) port;
+  Run[2] = (uint8_t) (port >> 8);
+  memcpy(Run + 3, host, length);
+  putRecord(TBCTraceRecord::Connect, micros(), Run, length + 3);
+  Open = result == 1;
+  return result;
+}
+
+size_t TBCRecordClient::write(uint8_t c)
+{
+  size_t result = Inner->write(c);
+  if (result > 0) collect(TBCTraceRecord::Write, &c, 1);
+  return result;
+}
+
+size_t TBCRecordClient::write(const uint8_t* buffer, size_t size)
+{
+  size_t result = Inner->write(buffer, size);
+  if (result > 0) collect(TBCTraceRecord::Write, buffer, result);
+  return result;
+}
+
+int TBCRecordClient::available()
+{
+  int result = Inner->available();
+  if (result == 0) checkEof();
+  return result;
+}
+
+int TBCRecordClient::read()
+{
+  int result = Inner->read();
+  if (result >= 0)
+  {
+    uint8_t c = (uint8_t) result;
+    collect(TBCTraceRecord::Read, &c, 1);
+  }
+  return result;
+}
+
+int TBCRecordClient::read(uint8_t* buffer, size_t size)
+{
+  int result = Inner->read(buffer, size);
+  if (result > 0) collect(TBCTraceRecord::Read, buffer, result);
+  return result;
+}
+
+int TBCRecordClient::peek()
+{
+  return Inner->peek();
+}
+
+void TBCRecordClient::flush()
+{
+  Inner->flush();
+}
+
+void TBCRecordClient::stop()
+{
+  end();
+  Inner->stop();
+  if (!Open) return;
+  putRecord(TBCTraceRecord::Stop, micros(), 0, 0);
+  Open = false;
+}
+
+uint8_t TBCRecordClient::connected()
+{
+  uint8_t result = Inner->connected();
+  if (!result) checkEof();
+  return result;
+}
+
+TBCRecordClient::operator bool()
+{
+  return (bool) *Inner;
+}
+
+TBCReplayClient::TBCReplayClient(Stream& source)
+{
+  DOUT("New TBCReplayClient");
+  this->Source = &source;
+}
+
+void TBCReplayClient::setSpeed(float speed)
+{
+  this->Speed = speed;
+}
+
+bool TBCReplayClient::getVarint(unsigned long& value)
+{
+  value = 0;
+  for (int shift = 0; shift < 35; shift += 7)
+  {
+    int c = Source->read();
+    if (c < 0) return false;
+    value |= (unsigned long) (c & 0x7f) << shift;
+    if ((c & 0x80) == 0) return true;
+  }
+  return false;
+}
+
+bool TBCReplayClient::load()
+{
+  if (Loaded) return true;
+  if (Ended) return false;
+  if (!Started)
+  {
+    char magic[4];
+    Started = true;
+    if (Source->readBytes(magic, 4) != 4 || memcmp(magic, TBC_TRACE_MAGIC, 4) != 0)
+    {
+      DOUT("Not a trace");
+      Ended = true;
+      return false;
+    }
+  }
+  int type = Source->read();
+  unsigned long delta;
+  unsigned long length;
+  if (type < 0 || !getVarint(delta) || !getVarint(length))
+  {
+    Ended = true;
+    return false;
+  }
+  Type = (TBCTraceRecord) type;
+  Due += delta;
+  Remaining = length;
+  Loaded = true;
+  return true;
+}
+
+void TBCReplayClient::skip()
+{
+  while (Remaining > 0)
+  {
+    if (Source->read() < 0)
+    {
+      Ended = true;
+      break;
+    }
+    Remaining--;
+  }
+  Loaded = false;
+}
+
+bool TBCReplayClient::due()
+{
+  if (Speed <= 0) return true;
+  return (micros() - Anchor) >= (unsigned long) (Due / Speed);
+}
+
+void TBCReplayClient::rebase()
+{
+  Anchor = micros();
+  Due = 0;
+}
+
+int TBCReplayClient::connectNext()
+{
+  Open = false;
+  while (load() && Type != TBCTraceRecord::Connect) skip();
+  if (!Loaded) return 0;
+  int result = Source->read();
+  if (Remaining > 0) Remaining--;
+  skip();
+  rebase();
+  Wrote = false;
+  Open = result == 1;
+  return result < 0 ? 0 : result;
+}
+
+size_t TBCReplayClient::advance()
+{
+  if (!Open) return 0;
+  while (load())
+  {
+    switch (Type)
+    {
+      case TBCTraceRecord::Write:
+        // the answer to a request is timed from the replayed write
+        if (!Wrote) return 0;
+        skip();
+        rebase();
+        continue;
+      case TBCTraceRecord::Read:
+        Wrote = false;
+        if (Remaining == 0)
+        {
+          skip();
+          continue;
+        }
+        return due() ? Remaining : 0;
+      case TBCTraceRecord::Eof:
+        if (due())
+        {
+          skip();
+          Open = false;
+        }
+        return 0;
+      default:
+        // the recorded application stopped or reconnected here
+        return 0;
+    }
+  }
+  Open = false;
+  return 0;
+}
+
+int TBCReplayClient::connect(IPAddress ip, uint16_t port)
+{
+  return connectNext();
+}
+
+int TBCReplayClient::connect(const char* host, uint16_t port)
+{
+  return connectNext();
+}
+
+size_t TBCReplayClient::write(uint8_t c)
+{
+  return write(&c, 1);
+}
+
+size_t TBCReplayClient::write(const uint8_t* buffer, size_t size)
+{
+  if (!Open) return 0;
+  Written += size;
+  Wrote = true;
+  return size;
+}
+
+int TBCReplayClient::available()
+{
+  return (int) advance();
+}
+
+int TBCReplayClient::read()
+{
+  if (advance() == 0) return -1;
+  int result = Source->read();
+  if (--Remaining == 0) Loaded = false;
+  return result;
+}
+
+int TBCReplayClient::read(uint8_t* buffer, size_t size)
+{
+  size_t count = advance();
+  if (count == 0) return -1;
+  if (count > size) count = size;
+  count = Source->readBytes((char*) buffer, count);
+  Remaining -= count;
+  if (Remaining == 0) Loaded = false;
+  return (int) count;
+}
+
+int TBCReplayClient::peek()
+{
+  if (advance() == 0) return -1;
+  return Source->peek();
+}
+
+void TBCReplayClient::flush()
+{
+}
+
+void TBCReplayClient::stop()
+{
+  Open = false;
+}
+
+uint8_t TBCReplayClient::connected()
+{
+  advance();
+  return Open ? 1 : 0;
+}
+
+TBCReplayClient::operator bool()
+{
+  return Open;
+}
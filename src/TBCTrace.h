@@ -0,0 +1,307 @@
+/**
+    \file TBCTrace.h
+    \brief Header of Client decorators recording the byte timeline of
+           a connection to a trace and replaying such a trace.
+
+    Part of TelegramBotClient (https://github.com/schlingensiepen/TelegramBotClient)
+    Jörn Schlingensiepen <joern@schlingensiepen.com>
+*/
+#pragma once
+#ifndef TBCTrace_h
+#define TBCTrace_h
+
+#include "TBCDebug.h"
+#include "Arduino.h"
+#include <Client.h>
+
+/** Bytes read or written within this many microseconds form one record */
+#ifndef TBC_TRACE_MERGE_MICROS
+#define TBC_TRACE_MERGE_MICROS 500
+#endif
+
+/** Size of the buffer collecting a record before it is written */
+#ifndef TBC_TRACE_RUN
+#ifdef ESP8266
+#define TBC_TRACE_RUN 128
+#else
+#define TBC_TRACE_RUN 512
+#endif
+#endif
+
+/** Magic and version starting every trace */
+#define TBC_TRACE_MAGIC "TBT1"
+
+/**
+   \enum TBCTraceRecord
+
+   \file TBCTrace.h
+
+   \brief Types of the records of a trace.
+
+   \details A trace starts with TBC_TRACE_MAGIC followed by records.
+   Every record is its type byte, the microseconds since the previous
+   record and the length of its data, both as base 128 varint, and
+   the data.
+
+   \note Should only be used as a part of TelegramBotClient
+   (https://github.com/schlingensiepen/TelegramBotClient)
+
+   \author Jörn Schlingensiepen <joern@schlingensiepen.com>
+
+*/
+enum class TBCTraceRecord : uint8_t
+{
+  /** Connect, data is the result, the port (2 bytes) and the host */
+  Connect = 'C',
+  /** Bytes written by the application */
+  Write = 'W',
+  /** Bytes read by the application */
+  Read = 'R',
+  /** Connection closed by the application */
+  Stop = 'S',
+  /** Connection closed by the peer */
+  Eof = 'E'
+};
+
+/**
+   \class TBCRecordClient
+
+   \file TBCTrace.h
+
+   \brief TBCRecordClient recorder(sslPollClient, traceFile);
+
+   Client passing everything to another client while appending what
+   the application writes and reads, with the time it happened, to a
+   trace. Bytes arriving in one go are merged to one record, records
+   are written when complete, so the sink sees few and large writes.
+   The trace can be fed back by TBCReplayClient.
+
+   \note Should only be used as a part of TelegramBotClient
+   (https://github.com/schlingensiepen/TelegramBotClient)
+
+   \author Jörn Schlingensiepen <joern@schlingensiepen.com>
+
+*/
+class TBCRecordClient : public Client
+{
+  private:
+    /** The recorded client */
+    Client* Inner;
+    /** Sink of the trace */
+    Print* Sink;
+    /** Time of the last record written */
+    unsigned long Last;
+    /** Indicates the magic is written */
+    bool Started = false;
+    /** Indicates the inner client was seen connected */
+    bool Open = false;
+    /** Type of the record collected in Run */
+    TBCTraceRecord RunType = TBCTraceRecord::Stop;
+    /** Time the record collected in Run started */
+    unsigned long RunStart = 0;
+    /** Bytes of the record collected */
+    uint8_t Run[TBC_TRACE_RUN];
+    /** Number of bytes in Run */
+    size_t RunLength = 0;
+
+    /**
+        \brief Writes a number as base 128 varint to the sink
+
+        \param [in] value The number
+    */
+    void putVarint(unsigned long value);
+    /**
+        \brief Writes a complete record to the sink
+
+        \param [in] type Type of the record
+        \param [in] time Time the record happened
+        \param [in] data Data of the record
+        \param [in] length Length of data
+    */
+    void putRecord(TBCTraceRecord type, unsigned long time,
+                   const uint8_t* data, size_t length);
+    /**
+        \brief Adds data to the collected record
+
+        \details Starts a new record if the type differs, the record
+        is older than TBC_TRACE_MERGE_MICROS or Run is full.
+        \param [in] type Type of the record
+        \param [in] data Data to add
+        \param [in] length Length of data
+    */
+    void collect(TBCTraceRecord type, const uint8_t* data, size_t length);
+    /**
+        \brief Records an Eof if the inner client lost its connection
+    */
+    void checkEof();
+
+  public:
+    /**
+        \brief Constructor
+
+        \param [in] inner The client to record
+        \param [in] sink Sink of the trace, e.g. an open file
+    */
+    TBCRecordClient(Client& inner, Print& sink);
+    /**
+        \brief Destructor, writes the collected record
+    */
+    ~TBCRecordClient();
+    /**
+        \brief Writes the collected record to the sink
+
+        \details Call before closing the sink.
+    */
+    void end();
+
+    int connect(IPAddress ip, uint16_t port);
+    int connect(const char* host, uint16_t port);
+    using Print::write;
+    size_t write(uint8_t c);
+    size_t write(const uint8_t* buffer, size_t size);
+    int available();
+    int read();
+    int read(uint8_t* buffer, size_t size);
+    int peek();
+    void flush();
+    void stop();
+    uint8_t connected();
+    operator bool();
+};
+
+/**
+   \class TBCReplayClient
+
+   \file TBCTrace.h
+
+   \brief TBCReplayClient replay(traceFile);
+
+   Client feeding a trace recorded by TBCRecordClient back to the
+   application. Read data becomes available at its recorded time,
+   scaled by the speed set, relative to the last connect or write so
+   a slow application does not see the server answer early. Written
+   data is counted and dropped. Connects succeed or fail as
+   recorded, a trace holding several connections is replayed one
+   connection per connect().
+
+   \note Should only be used as a part of TelegramBotClient
+   (https://github.com/schlingensiepen/TelegramBotClient)
+
+   \author Jörn Schlingensiepen <joern@schlingensiepen.com>
+
+*/
+class TBCReplayClient : public Client
+{
+  private:
+    /** Source of the trace */
+    Stream* Source;
+    /** Factor applied to the recorded times, 0 for no waiting */
+    float Speed = 1;
+    /** Type of the current record */
+    TBCTraceRecord Type = TBCTraceRecord::Stop;
+    /** Recorded time of the current record since the anchor */
+    unsigned long Due = 0;
+    /** Bytes of the current record not read yet */
+    size_t Remaining = 0;
+    /** Indicates the current record is loaded */
+    bool Loaded = false;
+    /** Indicates the magic was checked */
+    bool Started = false;
+    /** Indicates the end of the trace */
+    bool Ended = false;
+    /** Indicates a connection is replayed */
+    bool Open = false;
+    /** Local time matching recorded time 0 */
+    unsigned long Anchor = 0;
+    /** Bytes written by the application */
+    unsigned long Written = 0;
+    /** Indicates the application wrote since the last Write record */
+    bool Wrote = false;
+
+    /**
+        \brief Reads a base 128 varint from the source
+
+        \param [out] value The number read
+        \return False at the end of the trace
+    */
+    bool getVarint(unsigned long& value);
+    /**
+        \brief Loads the next record header if none is loaded
+
+        \return False at the end of the trace
+    */
+    bool load();
+    /**
+        \brief Skips the data of the current record
+    */
+    void skip();
+    /**
+        \brief Indicates the current record is due
+
+        \return True if its recorded time has passed
+    */
+    bool due();
+    /**
+        \brief Makes now the time of the record just consumed
+    */
+    void rebase();
+    /**
+        \brief Skips to the next Connect record and replays it
+
+        \return Result of the recorded connect
+    */
+    int connectNext();
+    /**
+        \brief Consumes Write and due Eof records
+
+        \return Bytes of a due Read record available
+    */
+    size_t advance();
+
+  public:
+    /**
+        \brief Constructor
+
+        \param [in] source The trace, positioned at its start
+    */
+    TBCReplayClient(Stream& source);
+    /**
+        \brief Sets the speed of the replay
+
+        \param [in] speed 1 for the recorded timing, 2 for twice as
+        fast, 0 to deliver data as soon as it is read
+    */
+    void setSpeed(float speed);
+    /**
+        \brief Bytes written by the application
+
+        \return Number of bytes
+    */
+    unsigned long written() {
+      return Written;
+    }
+    /**
+        \brief Indicates the whole trace was replayed
+
+        \return True at the end of the trace
+    */
+    bool ended() {
+      return Ended;
+    }
+
+    int connect(IPAddress ip, uint16_t port);
+    int connect(const char* host, uint16_t port);
+    using Print::write;
+    size_t write(uint8_t c);
+    size_t write(const uint8_t* buffer, size_t size);
+    int available();
+    int read();
+    int read(uint8_t* buffer, size_t size);
+    int peek();
+    void flush();
+    void stop();
+    uint8_t connected();
+    operator bool();
+};
+
+#endif
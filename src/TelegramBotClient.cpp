@@ -1,21 +1,40 @@
 #include "TelegramBotClient.h"
+#include "TBCDispatcher.h"
+#include "TBCSpool.h"
+
+const __FlashStringHelper* toString(TelegramProcessError err)
+{
+  switch (err)
+  {
+    case TelegramProcessError::Ok: return F("Ok");
+    case TelegramProcessError::JcwPollErr: return F("JcwPollErr");
+    case TelegramProcessError::JcwPostErr: return F("JcwPostErr");
+    case TelegramProcessError::RetPollErr: return F("RetPollErr");
+    case TelegramProcessError::RetPostErr: return F("RetPostErr");
+  }
+  return F("Unknown");
+}
 
 TelegramBotClient::TelegramBotClient (
   String token,
   Client& sslPollClient,
   Client& sslPostClient,
-  TBC_CALLBACK_RECEIVE_SIGNATURE,
-  TBC_CALLBACK_ERROR_SIGNATURE
+  TBCReceiveCallback callbackReceive,
+  TBCErrorCallback callbackError
 )
 {
   DOUT ("New TelegramBotClient");
-  this->Parallel = (sslPostClient != sslPollClient);
+  this->Parallel = (&sslPostClient != &sslPollClient);
   this->SslPollClient = new JsonWebClient(
-    &sslPollClient, TELEGRAMHOST, TELEGRAMPORT, this,
-    callbackPollSuccess, callbackPollError);
+    &sslPollClient, TBC_TELEGRAM_HOST, TELEGRAMPORT,
+    JwcMessageCallback(this, &TelegramBotClient::pollSuccess),
+    JwcErrorCallback(this, &TelegramBotClient::pollError));
   this->SslPostClient = new JsonWebClient(
-    &sslPostClient, TELEGRAMHOST, TELEGRAMPORT, this,
-    callbackPostSuccess, callbackPostError);
+    &sslPostClient, TBC_TELEGRAM_HOST, TELEGRAMPORT,
+    JwcMessageCallback(this, &TelegramBotClient::postSuccess),
+    JwcErrorCallback(this, &TelegramBotClient::postError));
+  this->SslPollClient->setBuffer(TBC_POLL_BUFF_SIZE);
+  this->SslPostClient->setBuffer(TBC_POST_BUFF_SIZE);
   this->Token = String(token);
   DOUTKV ("Token", this->Token);
   this->setCallbacks(
@@ -26,11 +45,13 @@ TelegramBotClient::~TelegramBotClient()
 {
   delete( SslPollClient );
   delete( SslPostClient );
+  delete[] ( BroadcastIds );
+  delete( Router );
 }
 
 void TelegramBotClient::setCallbacks (
-  TBC_CALLBACK_RECEIVE_SIGNATURE,
-  TBC_CALLBACK_ERROR_SIGNATURE)
+  TBCReceiveCallback callbackReceive,
+  TBCErrorCallback callbackError)
 {
   DOUT ("setCallbacks");
   this->callbackReceive = callbackReceive;
@@ -38,25 +59,175 @@ void TelegramBotClient::setCallbacks (
 }
 
 void TelegramBotClient::begin(
-  TBC_CALLBACK_RECEIVE_SIGNATURE,
-  TBC_CALLBACK_ERROR_SIGNATURE)
+  TBCReceiveCallback callbackReceive,
+  TBCErrorCallback callbackError)
 {
   setCallbacks(
     callbackReceive,
     callbackError);
+  if (OffsetStore != 0)
+  {
+    LastUpdateId = OffsetStore->begin();
+    DOUTKV ("LastUpdateId", LastUpdateId);
+  }
+  if (Spool != 0) Spool->begin();
+}
+
+void TelegramBotClient::setOffsetStore(TBCOffsetStore* store)
+{
+  DOUT ("setOffsetStore");
+  this->OffsetStore = store;
+}
+
+void TelegramBotClient::setSpool(TBCSpool* spool)
+{
+  DOUT ("setSpool");
+  TBCLock lock(Mutex);
+  this->Spool = spool;
+}
+
+void TelegramBotClient::setLatency(TBCLatency* latency)
+{
+  DOUT ("setLatency");
+  TBCLock lock(Mutex);
+  this->Latency = latency;
+}
+
+void TelegramBotClient::setLastUpdateId(long updateId)
+{
+  LastUpdateId = updateId;
+  if (OffsetStore != 0) OffsetStore->checkpoint(LastUpdateId);
 }
 
 
-bool TelegramBotClient::loop()
+void TelegramBotClient::setCoalescing(unsigned long window)
+{
+  DOUTKV ("setCoalescing", window);
+  this->CoalesceWindow = window;
+}
+
+void TelegramBotClient::setPostInterval(unsigned long interval)
 {
-  SslPollClient->loop();
-  SslPostClient->loop();
+  DOUTKV ("setPostInterval", interval);
+  this->PostInterval = interval;
+}
+
+void TelegramBotClient::setPipelining(uint8_t depth)
+{
+  if (!Parallel || depth == 0) depth = 1;
+  DOUTKV ("setPipelining", depth);
+  this->PipelineDepth = depth;
+  SslPostClient->setKeepAlive(depth > 1);
+}
+
+void TelegramBotClient::setPollTimeout(unsigned int timeout, bool adaptive)
+{
+  DOUTKV ("setPollTimeout", timeout);
+  this->PollTimeout = timeout;
+  this->MaxPollTimeout = timeout;
+  this->AdaptivePolling = adaptive;
+  this->SurvivedIdle = 0;
+  this->DropLimit = 0;
+  this->PollsCompleted = 0;
+}
+
+void TelegramBotClient::setBuffers(size_t pollSize, size_t postSize)
+{
+  DOUT ("setBuffers");
+  TBCLock lock(Mutex);
+  SslPollClient->setBuffer(pollSize);
+  SslPostClient->setBuffer(postSize);
+}
+
+void TelegramBotClient::setCompression(bool compression)
+{
+  DOUTKV ("setCompression", compression);
+  SslPollClient->setCompression(compression);
+}
+
+void TelegramBotClient::setConnectionHook(JwcConnectionHook callbackConnection)
+{
+  DOUT ("setConnectionHook");
+  TBCLock lock(Mutex);
+  SslPollClient->setConnectionHook(callbackConnection);
+  SslPostClient->setConnectionHook(callbackConnection);
+}
+
+void TelegramBotClient::setAddressCache(TBCAddressCache* cache)
+{
+  DOUT ("setAddressCache");
+  TBCLock lock(Mutex);
+  SslPollClient->setAddressCache(cache);
+  SslPostClient->setAddressCache(cache);
+}
+
+bool TelegramBotClient::onCommand(const char* command, TBCCommandCallback callbackCommand)
+{
+  TBCLock lock(Mutex);
+  if (Router == 0)
+  {
+    Router = new TBCCommandRouter();
+#ifdef TBC_THREADS
+    if (Dispatcher != 0) Dispatcher->setRouter(Router);
+#endif
+  }
+  return Router->on(command, callbackCommand);
+}
+
+void TelegramBotClient::setBotName(const char* botName)
+{
+  TBCLock lock(Mutex);
+  if (Router == 0) Router = new TBCCommandRouter();
+  Router->setBotName(botName);
+}
+
+#ifdef TBC_THREADS
+void TelegramBotClient::setDispatcher(TBCDispatcher* dispatcher)
+{
+  DOUT ("setDispatcher");
+  TBCLock lock(Mutex);
+  this->Dispatcher = dispatcher;
+  if (Dispatcher != 0) Dispatcher->setRouter(Router);
+}
+#endif
+
+bool TelegramBotClient::dispatchReady()
+{
+#ifdef TBC_THREADS
+  if (Dispatcher != 0) return Dispatcher->ready();
+#endif
+  return true;
+}
+
+bool TelegramBotClient::loop(unsigned long budgetMicros)
+{
+  TBCLock lock(Mutex);
+  unsigned long start = micros();
+  checkPoll();
+  checkPost();
+  expireHeld();
+  SslPollClient->loop(budgetMicros);
+  if (budgetMicros > 0)
+  {
+    // keep at least one step for the post client
+    unsigned long elapsed = micros() - start;
+    budgetMicros = (elapsed < budgetMicros) ? budgetMicros - elapsed : 1;
+  }
+  SslPostClient->loop(budgetMicros);
+  processUpload();
+  processDownload();
+  processOutbox();
 
   if (
     SslPollClient->state() == JwcClientState::Unconnected
+    && (millis() - PollStart) >= PollPause
+    && dispatchReady()
     &&
-    ( SslPostClient-> state() == JwcClientState::Unconnected
-      || Parallel
+    ( Parallel
+      // sharing the connection, queued posts are drained first unless
+      // the server asked to pause posting
+      || (SslPostClient-> state() == JwcClientState::Unconnected
+          && (PostPause > 0 || !postQueued()))
     ))
   {
     startPolling();
@@ -68,25 +239,73 @@ bool TelegramBotClient::loop()
 void TelegramBotClient::startPolling()
 {
   DOUT("startPolling");
-  String httpCommands[] =
-  {
-    "GET /bot"
-    + String(Token)
-    + "/getUpdates?limit=1&offset="
-    + String(LastUpdateId)
-    + "&timeout="
-    + String(POLLINGTIMEOUT)
-    + " HTTP/1.1",
+  PollStart = millis();
+  PollPause = 0;
+  if (!SslPollClient->beginRequest()) return;
 
-    "User-Agent: " + String(USERAGENTSTRING),
+  Print& out = SslPollClient->request();
+  out.print(F("GET /bot"));
+  out.print(Token);
+  out.print(F("/getUpdates?limit=1&offset="));
+  out.print(LastUpdateId);
+  out.print(F("&timeout="));
+  out.print(Burst ? 0 : PollTimeout);
+  out.println(F(" HTTP/1.1"));
+  out.print(F("User-Agent: "));
+  out.println(USERAGENTSTRING);
+  out.print(F("Host: "));
+  out.println(TELEGRAMHOST);
+  out.println(F("Accept: */*"));
+  SslPollClient->acceptEncoding();
+  out.println(); // indicate end of headers with empty line (http)
+  SslPollClient->endRequest();
+}
 
-    "Host: " + String(TELEGRAMHOST),
+bool TelegramBotClient::checkPoll()
+{
+  if (SslPollClient->state() == JwcClientState::Unconnected) return false;
+  unsigned long timeout = Burst ? 0 : PollTimeout;
+  if ((millis() - PollStart) / 1000 <= timeout + TBC_POLL_GRACE) return false;
+  DOUT("Poll not answered, connection dropped");
+  SslPollClient->stop();
+  pollDropped();
+  return true;
+}
 
-    "Accept: */*",
+void TelegramBotClient::pollCompleted(bool update)
+{
+  if (update || Burst)
+  {
+    // poll again immediately until no more updates are waiting
+    Burst = update;
+    DOUTKV("Burst", Burst);
+    return;
+  }
+  unsigned int elapsed = (millis() - PollStart) / 1000;
+  if (elapsed > SurvivedIdle) SurvivedIdle = elapsed;
+  if (!AdaptivePolling || PollTimeout >= MaxPollTimeout) return;
+  if (++PollsCompleted < TBC_POLL_GROW_AFTER) return;
+  PollsCompleted = 0;
+  unsigned int timeout = PollTimeout + PollTimeout / 4 + 1;
+  if (timeout > MaxPollTimeout) timeout = MaxPollTimeout;
+  if (DropLimit > 0 && timeout >= DropLimit) timeout = DropLimit - 1;
+  if (timeout > PollTimeout) PollTimeout = timeout;
+  DOUTKV("PollTimeout", PollTimeout);
+}
 
-    "" // indicate end of headers with empty line (http)
-  };
-  SslPollClient->fire (httpCommands, 5);
+void TelegramBotClient::pollDropped()
+{
+  Burst = false;
+  PollsCompleted = 0;
+  unsigned int elapsed = (millis() - PollStart) / 1000;
+  if (!AdaptivePolling || elapsed < TBC_MIN_POLL_TIMEOUT) return;
+  if (DropLimit == 0 || elapsed < DropLimit) DropLimit = elapsed;
+  unsigned int timeout = PollTimeout / 2;
+  if (SurvivedIdle > timeout && SurvivedIdle < PollTimeout) timeout = SurvivedIdle;
+  if (timeout >= DropLimit) timeout = DropLimit / 2;
+  if (timeout < TBC_MIN_POLL_TIMEOUT) timeout = TBC_MIN_POLL_TIMEOUT;
+  PollTimeout = timeout;
+  DOUTKV("PollTimeout", PollTimeout);
 }
 
 String charToString(const char* tmp)
@@ -108,7 +327,6 @@ void TelegramBotClient::pollSuccess(JwcProcessError err, JsonObject& payload)
   Message* msg = new Message();
   msg->UpdateId = payload["result"][0]["update_id"];
   DOUTKV("UpdateId", msg->UpdateId);
-  LastUpdateId = msg->UpdateId + 1;
   msg->MessageId = payload["result"][0]["message"]["message_id"];
   DOUTKV("MessageId", msg->MessageId);
   msg->FromId = payload["result"][0]["message"]["from"]["id"];
@@ -133,18 +351,64 @@ void TelegramBotClient::pollSuccess(JwcProcessError err, JsonObject& payload)
   DOUTKV("Text", msg->Text);
   msg->Date = payload["result"][0]["message"]["date"];
   DOUTKV("Date", msg->Date);
-  if (msg->FromId == 0 || msg->ChatId == 0 || msg->Text.length() == 0)
+  msg->Caption = charToString(payload["result"][0]["message"]["caption"]);
+  DOUTKV("Caption", msg->Caption);
+  JsonArray& photo = payload["result"][0]["message"]["photo"];
+  if (photo.success() && photo.size() > 0)
+  {
+    // the last photo size is the largest
+    msg->FileId = charToString(photo[photo.size() - 1]["file_id"]);
+    msg->FileSize = photo[photo.size() - 1]["file_size"];
+  }
+  else
+  {
+    msg->FileId = charToString(payload["result"][0]["message"]["document"]["file_id"]);
+    msg->FileName = charToString(payload["result"][0]["message"]["document"]["file_name"]);
+    msg->MimeType = charToString(payload["result"][0]["message"]["document"]["mime_type"]);
+    msg->FileSize = payload["result"][0]["message"]["document"]["file_size"];
+  }
+  DOUTKV("FileId", msg->FileId);
+  DOUTKV("FileSize", msg->FileSize);
+  if (msg->FromId == 0 || msg->ChatId == 0
+      || (msg->Text.length() == 0 && msg->FileId.length() == 0))
   {
     // no message, just the timeout from server
     DOUT("Timout by server");
+    pollCompleted(msg->UpdateId != 0);
+    // idle, write a checkpoint delayed by the offset store
+    if (OffsetStore != 0) OffsetStore->flush();
   }
   else
   {
-    if (callbackReceive != 0)
+    pollCompleted(true);
+    if (Latency != 0) Latency->received(SslPollClient->times(), msg->Date);
+#ifdef TBC_THREADS
+    if (Dispatcher != 0)
     {
-      callbackReceive(TelegramProcessError::Ok, err, msg);
+      if (!Dispatcher->push(*msg))
+      {
+        // not acknowledged, received again when the queue has space
+        delete (msg);
+        return;
+      }
+    }
+    else
+#endif
+    {
+      if (Latency != 0) Latency->enter();
+      if (Router != 0 && Router->dispatch(msg))
+      {
+        DOUT("Command handled");
+      }
+      else if (callbackReceive != 0)
+      {
+        callbackReceive(TelegramProcessError::Ok, err, msg);
+      }
+      if (Latency != 0) Latency->leave();
     }
   }
+  // the update was processed, do not receive it again after a restart
+  if (msg->UpdateId != 0) setLastUpdateId(msg->UpdateId + 1);
   delete (msg);
 }
 void TelegramBotClient::pollError(JwcProcessError err, Client* client)
@@ -153,117 +417,1014 @@ void TelegramBotClient::pollError(JwcProcessError err, Client* client)
   switch (err)
   {
     case JwcProcessError::HttpErr: {
+        HttpStatus = SslPollClient->statusCode();
+        DOUTKV("HttpStatus", HttpStatus);
+        if (SslPollClient->retryAfter() > 0)
+        {
+          PollStart = millis();
+          PollPause = SslPollClient->retryAfter() * 1000;
+        }
         if (callbackError != 0) callbackError(TelegramProcessError::JcwPollErr, err); break;
       }
     case JwcProcessError::MsgTooBig: {
         if (callbackError != 0) callbackError(TelegramProcessError::JcwPollErr, err);
 
-        // This should find the update_id in JSON:
+        // The head of the body already received holds the first update_id:
         // {"ok":true,"result":[{"update_id":512650849, ...
-        String token = "";
-        do
+        const char* token = strstr_P(SslPollClient->bodyHead(), PSTR("\"update_id\":"));
+        if (token != 0)
+        {
+          setLastUpdateId(atol(token + 12) + 1);
+        }
+        else
         {
-          token = client->readStringUntil(',');
-          DOUTKV ("Token", token);
-        } while (token.indexOf("update_id") <= 0);
-        token = token.substring(token.lastIndexOf(":") + 1);
-        DOUTKV ("Token", token);
-        LastUpdateId = token.toInt() + 1;
+          DOUT("No update_id received, skipping next update");
+          setLastUpdateId(LastUpdateId + 1);
+        }
         DOUTKV ("LastUpdateId", LastUpdateId);
         break;
       }
     case JwcProcessError::MsgJsonErr: {
         if (callbackError != 0) callbackError(TelegramProcessError::JcwPollErr, err);
         //TODO: Try to get LastUpdateId somehow
-        LastUpdateId++;
+        setLastUpdateId(LastUpdateId + 1);
+        break;
+      }
+    case JwcProcessError::ConnLost: {
+        // poll is started again by loop()
+        DOUT("Poll connection lost");
+        pollDropped();
         break;
       }
   }
 }
 
-void TelegramBotClient::startPosting(String msg) {
-  if (!Parallel) SslPollClient->stop();
-
-  String httpCommands[] =
-  {
-    "POST /bot"
-    + String(Token)
-    + "/sendMessage"
-    + " HTTP/1.1",
-
-    "Host: " + String(TELEGRAMHOST),
-
-    "User-Agent: " + String(USERAGENTSTRING),
+bool TelegramBotClient::beginPosting(
+  const __FlashStringHelper* method,
+  const __FlashStringHelper* contentType,
+  size_t length)
+{
+  LastPost = millis();
+  PostPause = 0;
+  if (!SslPostClient->beginRequest()) return false;
+  // only ok and message_id of the echoed message are needed
+  SslPostClient->setAckFilter(true);
 
-    "Content-Type: application/json",
+  Print& out = SslPostClient->request();
+  out.print(F("POST /bot"));
+  out.print(Token);
+  out.print('/');
+  out.print(method);
+  out.println(F(" HTTP/1.1"));
+  out.print(F("Host: "));
+  out.println(TELEGRAMHOST);
+  out.print(F("User-Agent: "));
+  out.println(USERAGENTSTRING);
+  out.print(F("Content-Type: "));
+  out.println(contentType);
+  out.println(PipelineDepth > 1 ? F("Connection: keep-alive") : F("Connection: close"));
+  out.print(F("Content-Length: "));
+  out.println(length);
+  out.println(); // indicate end of headers by empty line --> http
+  return true;
+}
 
-    "Connection: close",
+bool TelegramBotClient::startPosting(String msg) {
+  if (!beginPosting(F("sendMessage"), F("application/json"), msg.length())) return false;
+  SslPostClient->request().print(msg);
+  return SslPostClient->endRequest();
+}
 
-    "Content-Length: " + String (msg.length()),
+String keyBoardToString(TBCKeyBoard& keyBoard)
+{
+  String keyBoardString;
+  if (keyBoard.length() == 0) return keyBoardString;
 
-    "", // indicate end of headers by empty line --> http
+  DynamicJsonBuffer jsonBuffer (TBC_JSON_BUFF_SIZE);
+  JsonObject& obj = jsonBuffer.createObject();
+  JsonObject& jsonReplyMarkup = obj.createNestedObject("reply_markup");
+  JsonArray& jsonKeyBoard = jsonReplyMarkup.createNestedArray("keyboard");
+  DOUTKV("keyBoard.length()", keyBoard.length());
+  for (int i = 0; i < keyBoard.length(); i++)
+  {
+    DOUTKV("board.length(i): ", keyBoard.length(i));
+    JsonArray& jsonRow = jsonKeyBoard.createNestedArray();
+    for (int ii = 0; ii < keyBoard.length(i); ii++)
+    {
+      jsonRow.add(keyBoard.get(i, ii));
+    }
+  }
+  obj.set<bool>("one_time_keyboard", keyBoard.getOneTime());
+  obj.set<bool>("resize_keyboard", keyBoard.getResize());
+  obj.set<bool>("selective", false);
 
-    msg
-  };
-  SslPostClient->fire(httpCommands, 8);
+  obj.printTo(keyBoardString);
+  // keep the members only, they are appended to the message object
+  keyBoardString = keyBoardString.substring(1, keyBoardString.length() - 1);
+  DOUTKV("keyBoard", keyBoardString);
+  return keyBoardString;
 }
 
-void TelegramBotClient::postMessage(long chatId, String text, TBCKeyBoard &keyBoard)
+bool TelegramBotClient::postMessage(long chatId, String text, TBCKeyBoard &keyBoard,
+                                    TBCPriority priority, TBCDelivery delivery)
 {
+  TBCLock lock(Mutex);
   if (chatId == 0) {
     DOUT("Chat not defined.");
-    return;
+    return false;
   }
 
   DOUT("postMessage");
   DOUTKV("chatId", chatId);
   DOUTKV("text", text);
 
-  DynamicJsonBuffer jsonBuffer (JWC_BUFF_SIZE);
+  if (!storeMessage(chatId, text, keyBoardToString(keyBoard), priority, delivery)) return false;
+  processOutbox();
+  return true;
+}
+
+bool TelegramBotClient::storeMessage(long chatId, const String& text, const String& keyBoard,
+                                     TBCPriority priority, TBCDelivery delivery)
+{
+  if (Spool != 0 && Spool->count() > 0 && priority != TBCPriority::Alarm)
+  {
+    // keep the order, spooled messages are posted first
+    return Spool->push(chatId, text, keyBoard, priority, delivery);
+  }
+  if (queueMessage(chatId, text, keyBoard, priority, delivery)) return true;
+  return Spool != 0 && Spool->push(chatId, text, keyBoard, priority, delivery);
+}
+
+bool TelegramBotClient::broadcast(const long chatIds[], uint count, String text, TBCKeyBoard& keyBoard)
+{
+  TBCLock lock(Mutex);
+  if (BroadcastIds != 0) {
+    DOUT("Broadcast still running.");
+    return false;
+  }
+  DOUT("broadcast");
+  DOUTKV("count", count);
+  if (count == 0) return true;
+
+  DynamicJsonBuffer jsonBuffer (TBC_JSON_BUFF_SIZE);
   JsonObject& obj = jsonBuffer.createObject();
-  obj["chat_id"] = chatId;
   obj["text"] = text;
+  String body;
+  obj.printTo(body);
+  // drop the opening brace, the chat_id member is written in front of the others
+  BroadcastBody = body.substring(1);
+  String keyBoardString = keyBoardToString(keyBoard);
+  if (keyBoardString.length() > 0)
+  {
+    BroadcastBody.remove(BroadcastBody.length() - 1);
+    BroadcastBody += ',';
+    BroadcastBody += keyBoardString;
+    BroadcastBody += '}';
+  }
+  DOUTKV("BroadcastBody", BroadcastBody);
+
+  BroadcastIds = new long[count];
+  for (uint i = 0; i < count; i++)
+  {
+    BroadcastIds[i] = chatIds[i];
+  }
+  BroadcastCount = count;
+  BroadcastIndex = 0;
+  BroadcastAcked = 0;
+  processOutbox();
+  return true;
+}
 
-  if (keyBoard.length() > 0 )
+void TelegramBotClient::postBroadcast()
+{
+  uint index = BroadcastIndex;
+  String chatId = String(BroadcastIds[index]);
+  DOUTKV("postBroadcast", chatId);
+  // {"chat_id":<chatId>,<BroadcastBody>
+  size_t length = 11 + chatId.length() + 1 + BroadcastBody.length();
+  if (beginPosting(F("sendMessage"), F("application/json"), length))
   {
-    JsonObject& jsonReplyMarkup = obj.createNestedObject("reply_markup");
-    JsonArray& jsonKeyBoard = jsonReplyMarkup.createNestedArray("keyboard");
-    DOUTKV("keyBoard.length()", keyBoard.length());
-    for (int i = 0; i < keyBoard.length(); i++)
+    Print& out = SslPostClient->request();
+    out.print(F("{\"chat_id\":"));
+    out.print(chatId);
+    out.print(',');
+    out.print(BroadcastBody);
+    if (SslPostClient->endRequest())
     {
-      DOUTKV("board.length(i): ", keyBoard.length(i));
-      JsonArray& jsonRow = jsonKeyBoard.createNestedArray();
-      for (int ii = 0; ii < keyBoard.length(i); ii++)
-      {
-        jsonRow.add(keyBoard.get(i, ii));
-      }
+      BroadcastIndex++;
+      return;
     }
-    obj.set<bool>("one_time_keyboard", keyBoard.getOneTime());
-    obj.set<bool>("resize_keyboard", keyBoard.getResize());
-    obj.set<bool>("selective", false);
+  }
+  if (BroadcastIndex == index && BroadcastAcked == index)
+  {
+    DOUT("Post failed, chat skipped");
+    BroadcastIndex++;
+    BroadcastAcked++;
+    checkBroadcast();
+  }
+}
+
+void TelegramBotClient::checkBroadcast()
+{
+  if (BroadcastIds == 0 || BroadcastAcked < BroadcastCount) return;
+  DOUT("Broadcast finished");
+  delete[] ( BroadcastIds );
+  BroadcastIds = 0;
+  BroadcastCount = 0;
+  BroadcastIndex = 0;
+  BroadcastAcked = 0;
+  BroadcastBody = String();
+}
+
+bool TelegramBotClient::queueMessage(long chatId, const String& text, const String& keyBoard,
+                                     TBCPriority priority, TBCDelivery delivery)
+{
+  // behind the messages in flight and the queued ones of the same or higher class
+  uint position = OutboxCount;
+  while (position > OutboxInFlight
+         && Outbox[(OutboxHead + position - 1) % TBC_OUTBOX_SIZE].Priority > priority)
+    position--;
+  if (CoalesceWindow > 0 && position > OutboxInFlight && priority != TBCPriority::Alarm)
+  {
+    TBCOutMessage& last = Outbox[(OutboxHead + position - 1) % TBC_OUTBOX_SIZE];
+    if (last.Priority == priority
+        && last.Delivery == delivery
+        && last.ChatId == chatId
+        && last.KeyBoard == keyBoard
+        && (millis() - last.Queued) < CoalesceWindow
+        && last.Text.length() + 1 + text.length() <= TBC_MAX_MESSAGE_LENGTH)
+    {
+      DOUT("Coalescing message");
+      last.Text += '\n';
+      last.Text += text;
+      return true;
+    }
+  }
+  if (OutboxCount >= TBC_OUTBOX_SIZE)
+  {
+    DOUT("Outbox full");
+    return false;
+  }
+  for (uint i = OutboxCount; i > position; i--)
+  {
+    TBCOutMessage& to = Outbox[(OutboxHead + i) % TBC_OUTBOX_SIZE];
+    TBCOutMessage& from = Outbox[(OutboxHead + i - 1) % TBC_OUTBOX_SIZE];
+    to = from;
+  }
+  TBCOutMessage& next = Outbox[(OutboxHead + position) % TBC_OUTBOX_SIZE];
+  next.ChatId = chatId;
+  next.Text = text;
+  next.KeyBoard = keyBoard;
+  next.Queued = millis();
+  next.Priority = priority;
+  next.Delivery = delivery;
+  next.Traced = Latency != 0 && Latency->inCallback();
+  if (next.Traced)
+  {
+    next.QueuedMicros = micros();
+    next.Origin = Latency->origin();
+    Latency->add(TBCStage::ReplyQueued, Latency->entered(), next.QueuedMicros);
+  }
+  OutboxCount++;
+  DOUTKV("OutboxCount", OutboxCount);
+  return true;
+}
+
+bool TelegramBotClient::readyToPost()
+{
+  if ((millis() - LastPost) < PostInterval + PostPause) return false;
+  if (PipelineDepth > 1) return SslPostClient->pending() < PipelineDepth;
+  JwcClientState postState = SslPostClient->state();
+  if (postState != JwcClientState::Unconnected
+      && postState != JwcClientState::Connected) return false;
+  return claimConnection();
+}
+
+bool TelegramBotClient::claimConnection()
+{
+  if (Parallel) return true;
+  switch (SslPollClient->state())
+  {
+    case JwcClientState::Unconnected:
+      return true;
+    case JwcClientState::Headers:
+    case JwcClientState::Json:
+      // the update is on its way, post after receiving it
+      return false;
+    case JwcClientState::Waiting:
+      // a short poll is answered at once
+      if (Burst) return false;
+      // nothing received, the update is returned by the next poll
+      DOUT("Long poll stopped for posting");
+      SslPollClient->stop();
+      return true;
+    default:
+      SslPollClient->stop();
+      return true;
+  }
+}
+
+bool TelegramBotClient::postQueued()
+{
+  return OutboxCount > OutboxInFlight
+         || (Spool != 0 && Spool->count() > 0)
+         || (BroadcastIds != 0 && BroadcastIndex < BroadcastCount)
+         || UploadHead.length() > 0
+         || textPending()
+         || DownloadState == TBCDownloadState::Queued
+         || DownloadState == TBCDownloadState::Ready;
+}
+
+bool TelegramBotClient::alarmQueued()
+{
+  return OutboxCount > OutboxInFlight
+         && Outbox[(OutboxHead + OutboxInFlight) % TBC_OUTBOX_SIZE].Priority
+            == TBCPriority::Alarm;
+}
+
+bool TelegramBotClient::transferRunning()
+{
+  return (uploadPending() && UploadHead.length() == 0)
+         || DownloadState == TBCDownloadState::FileInfo
+         || DownloadState == TBCDownloadState::Data;
+}
+
+bool TelegramBotClient::processOutbox()
+{
+  unspool();
+  processText();
+  uint queued = OutboxCount - OutboxInFlight;
+  bool broadcastQueued = BroadcastIds != 0 && BroadcastIndex < BroadcastCount;
+  if (queued == 0 && !broadcastQueued) return false;
+  if (queued == 0)
+  {
+    if (uploadPending() || downloadPending()) return false;
+    // responses are matched by order, do not mix messages and broadcast
+    if (OutboxInFlight > 0) return false;
+    if (!readyToPost()) return false;
+    postBroadcast();
+    return true;
+  }
+  if (BroadcastIndex > BroadcastAcked) return false;
 
+  uint inFlight = OutboxInFlight;
+  TBCOutMessage& msg = Outbox[(OutboxHead + inFlight) % TBC_OUTBOX_SIZE];
+  if (msg.Priority == TBCPriority::Alarm)
+  {
+    // alarms pass uploads and downloads not started yet
+    if (transferRunning()) return false;
+  }
+  else
+  {
+    if (uploadPending() || downloadPending()) return false;
+    if ((millis() - msg.Queued) < CoalesceWindow) return false;
   }
+  // checked last, it may stop a poll sharing the connection
+  if (!readyToPost()) return false;
 
+  DynamicJsonBuffer jsonBuffer (TBC_JSON_BUFF_SIZE);
+  JsonObject& obj = jsonBuffer.createObject();
+  obj["chat_id"] = msg.ChatId;
+  obj["text"] = msg.Text;
   String msgString;
   obj.printTo(msgString);
+  if (msg.KeyBoard.length() > 0)
+  {
+    msgString.remove(msgString.length() - 1);
+    msgString += ',';
+    msgString += msg.KeyBoard;
+    msgString += '}';
+  }
   DOUTKV("json", msgString);
-  startPosting(msgString);
 
+  if (startPosting(msgString))
+  {
+    OutboxInFlight++;
+  }
+  else if (inFlight == 0 && OutboxInFlight == 0)
+  {
+    if (Spool != 0)
+    {
+      DOUT("Post failed, messages spooled");
+      spoolOutbox();
+    }
+    else
+    {
+      DOUT("Post failed, message dropped");
+      popOutbox();
+    }
+  }
+  return true;
+}
+
+void TelegramBotClient::spoolOutbox()
+{
+  // newest first, each one is stored in front of the older ones
+  while (OutboxCount > OutboxInFlight)
+  {
+    TBCOutMessage& msg = Outbox[(OutboxHead + OutboxCount - 1) % TBC_OUTBOX_SIZE];
+    Spool->push(msg.ChatId, msg.Text, msg.KeyBoard, msg.Priority, msg.Delivery, true);
+    msg.Text = String();
+    msg.KeyBoard = String();
+    OutboxCount--;
+  }
+  LastPost = millis();
+  PostPause = TBC_SPOOL_RETRY;
+}
+
+void TelegramBotClient::unspool()
+{
+  if (Spool == 0 || Spool->count() == 0) return;
+  // wait for the retry after a failed post
+  if ((millis() - LastPost) < PostInterval + PostPause) return;
+  long chatId;
+  String text;
+  String keyBoard;
+  TBCPriority priority;
+  TBCDelivery delivery;
+  while (OutboxCount < TBC_OUTBOX_SIZE
+         && Spool->shift(chatId, text, keyBoard, priority, delivery))
+  {
+    queueMessage(chatId, text, keyBoard, priority, delivery);
+  }
+}
+
+void TelegramBotClient::popOutbox()
+{
+  if (OutboxCount == 0) return;
+  Outbox[OutboxHead].Text = String();
+  Outbox[OutboxHead].KeyBoard = String();
+  OutboxHead = (OutboxHead + 1) % TBC_OUTBOX_SIZE;
+  OutboxCount--;
+}
+
+bool TelegramBotClient::sendFile(
+  const __FlashStringHelper* method,
+  const __FlashStringHelper* field,
+  long chatId, Stream& source, size_t length,
+  const String& fileName, const String& caption)
+{
+  TBCLock lock(Mutex);
+  if (uploadPending()) {
+    DOUT("Upload still running.");
+    return false;
+  }
+  DOUT("sendFile");
+  DOUTKV("length", length);
+
+  UploadHead = F("--" TBC_BOUNDARY "\r\n"
+                 "Content-Disposition: form-data; name=\"chat_id\"\r\n\r\n");
+  UploadHead += String(chatId);
+  UploadHead += F("\r\n");
+  if (caption.length() > 0)
+  {
+    UploadHead += F("--" TBC_BOUNDARY "\r\n"
+                    "Content-Disposition: form-data; name=\"caption\"\r\n\r\n");
+    UploadHead += caption;
+    UploadHead += F("\r\n");
+  }
+  UploadHead += F("--" TBC_BOUNDARY "\r\n"
+                  "Content-Disposition: form-data; name=\"");
+  UploadHead += field;
+  UploadHead += F("\"; filename=\"");
+  UploadHead += fileName;
+  UploadHead += F("\"\r\n"
+                  "Content-Type: application/octet-stream\r\n\r\n");
+
+  UploadSource = &source;
+  UploadRemaining = length;
+  UploadMethod = method;
+  processUpload();
+  return true;
+}
+
+/** Closes the multipart/form-data body of an upload */
+#define TBC_UPLOAD_TRAILER "\r\n--" TBC_BOUNDARY "--\r\n"
+
+bool TelegramBotClient::postText(long chatId, Stream& source, size_t length,
+                                 TBCPriority priority, TBCDelivery delivery)
+{
+  TBCLock lock(Mutex);
+  if (textPending()) {
+    DOUT("Long text still running.");
+    return false;
+  }
+  DOUT("postText");
+  DOUTKV("length", length);
+  TextSource = &source;
+  TextRemaining = length;
+  TextBuffer = String();
+  TextOffset = 0;
+  TextChatId = chatId;
+  TextPriority = priority;
+  TextDelivery = delivery;
+  processOutbox();
+  return true;
+}
+
+bool TelegramBotClient::postText(long chatId, const String& text,
+                                 TBCPriority priority, TBCDelivery delivery)
+{
+  TBCLock lock(Mutex);
+  if (textPending()) {
+    DOUT("Long text still running.");
+    return false;
+  }
+  DOUT("postText");
+  DOUTKV("length", text.length());
+  TextSource = 0;
+  TextRemaining = 0;
+  TextBuffer = text;
+  TextOffset = 0;
+  TextChatId = chatId;
+  TextPriority = priority;
+  TextDelivery = delivery;
+  processOutbox();
+  return true;
+}
+
+bool TelegramBotClient::readText()
+{
+  if (TextRemaining == 0) return false;
+  // take only what is already available, never wait for the source
+  int available = TextSource->available();
+  if (available <= 0) return false;
+  char buffer[TBC_UPLOAD_CHUNK];
+  size_t count = TextRemaining < TBC_UPLOAD_CHUNK ? TextRemaining : TBC_UPLOAD_CHUNK;
+  if (count > (size_t) available) count = available;
+  // readBytes() returns at once, the bytes are available
+  count = TextSource->readBytes(buffer, count);
+  if (count == 0) return false;
+  TextBuffer.reserve(TextBuffer.length() + count);
+  for (size_t i = 0; i < count; i++) TextBuffer += buffer[i];
+  TextRemaining -= count;
+  if (TextRemaining == 0) TextSource = 0;
+  return true;
+}
+
+bool TelegramBotClient::processText()
+{
+  if (!textPending() || OutboxCount > OutboxInFlight) return false;
+  // all slots may be in flight, the part waits for a free one
+  if (OutboxCount >= TBC_OUTBOX_SIZE && Spool == 0) return false;
+  // like the spool, parts are not read while posting is paused
+  if ((millis() - LastPost) < PostInterval + PostPause) return false;
+  if (TextRemaining > 0)
+  {
+    // only the rest of the last chunk is kept
+    TextBuffer.remove(0, TextOffset);
+    TextOffset = 0;
+  }
+  size_t units = 0;
+  size_t end = TextOffset;
+  size_t lineCut = 0;
+  size_t spaceCut = 0;
+  bool full = false;
+  while (end < TextBuffer.length() || readText())
+  {
+    uint8_t c = (uint8_t) TextBuffer[end];
+    // continuation bytes belong to the character started before
+    if ((c & 0xc0) != 0x80)
+    {
+      // characters outside the BMP take two UTF-16 code units
+      uint width = (c >= 0xf0) ? 2 : 1;
+      if (units + width > TBC_TEXT_PART)
+      {
+        full = true;
+        break;
+      }
+      units += width;
+      if (c == '\n') lineCut = end;
+      else if (c == ' ') spaceCut = end;
+    }
+    end++;
+  }
+  // the last part of the source is not complete yet
+  if (!full && TextRemaining > 0) return false;
+  size_t next = end;
+  if (full && lineCut > TextOffset)
+  {
+    end = lineCut;
+    next = lineCut + 1;
+  }
+  else if (full && spaceCut > TextOffset)
+  {
+    end = spaceCut;
+    next = spaceCut + 1;
+  }
+  String part = TextBuffer.substring(TextOffset, end);
+  // Telegram rejects empty messages
+  if (part.length() > 0)
+  {
+    DOUTKV("Text part", part.length());
+    if (!storeMessage(TextChatId, part, String(), TextPriority, TextDelivery))
+    {
+      // the part is cut again by the next loop(), the order is kept
+      DOUT("Outbox full, text part deferred");
+      return false;
+    }
+  }
+  TextOffset = next;
+  if (!textPending())
+  {
+    TextBuffer = String();
+    TextOffset = 0;
+  }
+  return part.length() > 0;
+}
+
+bool TelegramBotClient::processUpload()
+{
+  if (UploadSource == 0) return false;
+  if (UploadHead.length() > 0)
+  {
+    // wait for all pending posts, responses are matched by order
+    if (OutboxInFlight > 0 || BroadcastAcked < BroadcastIndex) return false;
+    if (alarmQueued()) return false;
+    if (DownloadState == TBCDownloadState::FileInfo
+        || DownloadState == TBCDownloadState::Data) return false;
+    if (!readyToPost()) return false;
+    size_t length = UploadHead.length() + UploadRemaining + sizeof(TBC_UPLOAD_TRAILER) - 1;
+    if (!beginPosting(UploadMethod,
+                      F("multipart/form-data; boundary=" TBC_BOUNDARY),
+                      length))
+    {
+      abortUpload(JwcProcessError::ConnLost);
+      return true;
+    }
+    SslPostClient->request().print(UploadHead);
+    UploadHead = String();
+    return true;
+  }
+
+  if (UploadRemaining > 0)
+  {
+    uint8_t buffer[TBC_UPLOAD_CHUNK];
+    size_t count = UploadRemaining < TBC_UPLOAD_CHUNK ? UploadRemaining : TBC_UPLOAD_CHUNK;
+    count = UploadSource->readBytes(buffer, count);
+    if (count == 0 || SslPostClient->request().write(buffer, count) != count)
+    {
+      DOUT("Upload failed");
+      SslPostClient->stop();
+      abortUpload(JwcProcessError::ConnLost);
+      return true;
+    }
+    UploadRemaining -= count;
+    return true;
+  }
+
+  SslPostClient->request().print(F(TBC_UPLOAD_TRAILER));
+  UploadSource = 0;
+  if (SslPostClient->endRequest())
+  {
+    UploadInFlight = true;
+  }
+  else
+  {
+    abortUpload(JwcProcessError::ConnLost);
+  }
+  return true;
+}
+
+void TelegramBotClient::abortUpload(JwcProcessError err)
+{
+  DOUT("abortUpload");
+  UploadSource = 0;
+  UploadRemaining = 0;
+  UploadHead = String();
+  UploadMethod = 0;
+  UploadInFlight = false;
+  if (callbackError != 0) callbackError(TelegramProcessError::JcwPostErr, err);
+}
+
+bool TelegramBotClient::downloadFile(String fileId, Print& sink, TBCDownloadCallback callbackDownload)
+{
+  TBCLock lock(Mutex);
+  if (downloadPending()) {
+    DOUT("Download still running.");
+    return false;
+  }
+  DOUTKV("downloadFile", fileId);
+  DownloadFile = fileId;
+  DownloadSize = 0;
+  DownloadSink = &sink;
+  this->callbackDownload = callbackDownload;
+  DownloadState = TBCDownloadState::Queued;
+  processDownload();
+  return true;
+}
+
+bool TelegramBotClient::processDownload()
+{
+  if (DownloadState != TBCDownloadState::Queued
+      && DownloadState != TBCDownloadState::Ready) return false;
+  // wait for all pending posts, responses are matched by order
+  if (uploadPending() || OutboxInFlight > 0 || BroadcastAcked < BroadcastIndex) return false;
+  if (alarmQueued()) return false;
+  if (!readyToPost()) return false;
+
+  LastPost = millis();
+  if (!SslPostClient->beginRequest())
+  {
+    abortDownload(TelegramProcessError::JcwPostErr, JwcProcessError::ConnLost);
+    return true;
+  }
+  // the file path is read from the full response
+  SslPostClient->setAckFilter(false);
+  Print& out = SslPostClient->request();
+  if (DownloadState == TBCDownloadState::Queued)
+  {
+    out.print(F("GET /bot"));
+    out.print(Token);
+    out.print(F("/getFile?file_id="));
+    out.print(DownloadFile);
+    DownloadState = TBCDownloadState::FileInfo;
+  }
+  else
+  {
+    out.print(F("GET /file/bot"));
+    out.print(Token);
+    out.print('/');
+    out.print(DownloadFile);
+    SslPostClient->setRawSink(DownloadSink, JwcRawCallback(this, &TelegramBotClient::postRaw));
+    DownloadState = TBCDownloadState::Data;
+  }
+  out.println(F(" HTTP/1.1"));
+  out.print(F("Host: "));
+  out.println(TELEGRAMHOST);
+  out.print(F("User-Agent: "));
+  out.println(USERAGENTSTRING);
+  out.println(PipelineDepth > 1 ? F("Connection: keep-alive") : F("Connection: close"));
+  out.println(); // indicate end of headers by empty line --> http
+  if (!SslPostClient->endRequest())
+  {
+    abortDownload(TelegramProcessError::JcwPostErr, JwcProcessError::ConnLost);
+  }
+  return true;
+}
+
+void TelegramBotClient::downloadSuccess(JsonObject& json)
+{
+  if (DownloadState == TBCDownloadState::Data)
+  {
+    DOUT("Download finished");
+    DownloadState = TBCDownloadState::Idle;
+    DownloadSink = 0;
+    DownloadFile = String();
+    return;
+  }
+  const char* path = json["result"]["file_path"];
+  if (!json["ok"] || path == 0)
+  {
+    DOUT("getFile failed");
+    abortDownload(TelegramProcessError::RetPostErr, JwcProcessError::Ok);
+    return;
+  }
+  DownloadFile = path;
+  DownloadSize = json["result"]["file_size"].as<long>();
+  DOUTKV("DownloadFile", DownloadFile);
+  DOUTKV("DownloadSize", DownloadSize);
+  DownloadState = TBCDownloadState::Ready;
+}
+
+void TelegramBotClient::abortDownload(TelegramProcessError tbcErr, JwcProcessError jwcErr)
+{
+  DOUT("abortDownload");
+  DownloadState = TBCDownloadState::Idle;
+  DownloadSink = 0;
+  DownloadFile = String();
+  if (callbackDownload != 0) callbackDownload(tbcErr, jwcErr, 0, DownloadSize);
+  else if (callbackError != 0) callbackError(tbcErr, jwcErr);
+}
+
+void TelegramBotClient::completePost()
+{
+  if (UploadInFlight)
+  {
+    DOUT("Upload finished");
+    UploadInFlight = false;
+    UploadMethod = 0;
+  }
+  else if (OutboxInFlight > 0)
+  {
+    popOutbox();
+    OutboxInFlight--;
+  }
+  else if (BroadcastAcked < BroadcastIndex)
+  {
+    BroadcastAcked++;
+    checkBroadcast();
+  }
+}
+
+void TelegramBotClient::postRaw(size_t received, long total)
+{
+  if (callbackDownload)
+    callbackDownload(TelegramProcessError::Ok, JwcProcessError::Ok,
+                     received, total < 0 ? DownloadSize : total);
 }
 
 void TelegramBotClient::postSuccess(JwcProcessError err, JsonObject& json)
 {
   DOUT("postSuccess");
-  json.printTo(Serial);
+  if (DownloadState == TBCDownloadState::FileInfo
+      || DownloadState == TBCDownloadState::Data)
+  {
+    downloadSuccess(json);
+    return;
+  }
+  const JwcAck& ack = SslPostClient->ack();
+  DOUTKV("MessageId", ack.MessageId);
+  if (ack.Ok && !UploadInFlight)
+  {
+    if (OutboxInFlight > 0) acked(Outbox[OutboxHead].ChatId, ack.MessageId);
+    else if (BroadcastAcked < BroadcastIndex) acked(BroadcastIds[BroadcastAcked], ack.MessageId);
+  }
+  if (Latency != 0 && !UploadInFlight && OutboxInFlight > 0 && Outbox[OutboxHead].Traced)
+  {
+    unsigned long now = micros();
+    Latency->add(TBCStage::ReplyAcked, Outbox[OutboxHead].QueuedMicros, now);
+    Latency->add(TBCStage::Total, Outbox[OutboxHead].Origin, now);
+  }
+  completePost();
 }
 void TelegramBotClient::postError(JwcProcessError err, Client* client)
 {
   DOUT("postError");
-  while (client->available() > 0)
+  if (DownloadState == TBCDownloadState::FileInfo
+      || DownloadState == TBCDownloadState::Data)
+  {
+    abortDownload(TelegramProcessError::JcwPostErr, err);
+    return;
+  }
+  if (err == JwcProcessError::ConnLost)
+  {
+    postLost();
+    return;
+  }
+  if (err == JwcProcessError::HttpErr)
+  {
+    HttpStatus = SslPostClient->statusCode();
+    DOUTKV("HttpStatus", HttpStatus);
+    if (HttpStatus == 429)
+    {
+      // too many requests, only the answered post was refused,
+      // the pipelined ones behind it are handled as lost
+      LastPost = millis();
+      PostPause = SslPostClient->retryAfter() > 0 ? SslPostClient->retryAfter() * 1000 : 1000;
+      if (UploadInFlight) abortUpload(err);
+      postLost(true);
+      return;
+    }
+  }
+  // skip the rest of the response without waiting for more data
+  while (client->available() > 0) client->read();
+  completePost();
+}
+
+bool TelegramBotClient::checkPost()
+{
+  JwcClientState state = SslPostClient->state();
+  if (state == JwcClientState::Unconnected
+      || state == JwcClientState::Connected) return false;
+  if (transferRunning()) return false;
+  if ((millis() - LastPost) / 1000 <= TBC_POST_TIMEOUT) return false;
+  DOUT("Post not answered, connection dropped");
+  SslPostClient->stop();
+  postLost();
+  return true;
+}
+
+void TelegramBotClient::postLost(bool refused)
+{
+  // the source of an upload was consumed, it can not be sent again
+  if (UploadInFlight) abortUpload(JwcProcessError::ConnLost);
+  // the requests were sent, nothing tells if they were delivered
+  uint kept = 0;
+  for (uint i = 0; i < OutboxInFlight; i++)
+  {
+    TBCOutMessage& msg = Outbox[(OutboxHead + i) % TBC_OUTBOX_SIZE];
+    if ((refused && i == 0) || msg.Delivery == TBCDelivery::AtLeastOnce)
+    {
+      DOUT("Posting message again");
+      if (kept != i) Outbox[(OutboxHead + kept) % TBC_OUTBOX_SIZE] = msg;
+      kept++;
+    }
+    else
+    {
+      holdMessage(msg);
+    }
+  }
+  // close the gap between the kept and the queued messages
+  uint removed = OutboxInFlight - kept;
+  for (uint i = OutboxInFlight; i < OutboxCount; i++)
+  {
+    Outbox[(OutboxHead + i - removed) % TBC_OUTBOX_SIZE] =
+      Outbox[(OutboxHead + i) % TBC_OUTBOX_SIZE];
+  }
+  for (uint i = OutboxCount - removed; i < OutboxCount; i++)
+  {
+    Outbox[(OutboxHead + i) % TBC_OUTBOX_SIZE].Text = String();
+    Outbox[(OutboxHead + i) % TBC_OUTBOX_SIZE].KeyBoard = String();
+  }
+  OutboxCount -= removed;
+  OutboxInFlight = 0;
+  if (PipelineDepth > 1 || (refused && kept == 0))
+  {
+    DOUT("Posting pending broadcast again");
+    BroadcastIndex = BroadcastAcked;
+  }
+  else
+  {
+    while (BroadcastAcked < BroadcastIndex) completePost();
+  }
+}
+
+void TelegramBotClient::holdMessage(const TBCOutMessage& msg)
+{
+  TBCSentId* sent = sentId(msg.ChatId);
+  if (sent == 0)
+  {
+    DOUT("Delivery unknown, message dropped");
+    return;
+  }
+  if (HeldCount >= TBC_HELD_SIZE)
+  {
+    DOUT("Delivery unknown, held message dropped");
+    releaseHeld(0);
+  }
+  DOUT("Delivery unknown, message held");
+  TBCOutMessage& held = Held[HeldCount++];
+  held = msg;
+  held.ProofId = sent->MessageId;
+  held.Lost = millis();
+}
+
+void TelegramBotClient::releaseHeld(uint index)
+{
+  for (uint i = index + 1; i < HeldCount; i++) Held[i - 1] = Held[i];
+  HeldCount--;
+  Held[HeldCount].Text = String();
+  Held[HeldCount].KeyBoard = String();
+}
+
+void TelegramBotClient::expireHeld()
+{
+  uint i = 0;
+  while (i < HeldCount)
+  {
+    if ((millis() - Held[i].Lost) < TBC_PROOF_TIMEOUT)
+    {
+      i++;
+      continue;
+    }
+    DOUT("Delivery not proven, held message dropped");
+    releaseHeld(i);
+  }
+}
+
+TBCSentId* TelegramBotClient::sentId(long chatId)
+{
+  for (uint i = 0; i < TBC_SENT_CHATS; i++)
   {
-    String line = client->readStringUntil('\n');
-    DOUTKV("line", line);
+    if (SentIds[i].ChatId == chatId) return &SentIds[i];
   }
+  return 0;
+}
+
+void TelegramBotClient::acked(long chatId, long messageId)
+{
+  if (messageId <= 0) return;
+  uint i = 0;
+  while (i < HeldCount)
+  {
+    TBCOutMessage& held = Held[i];
+    if (held.ChatId != chatId)
+    {
+      i++;
+      continue;
+    }
+    // no message got an id between the last known and this one
+    if (messageId == held.ProofId + 1)
+    {
+      DOUT("Not delivered, posting held message again");
+      if (!storeMessage(held.ChatId, held.Text, held.KeyBoard, held.Priority, held.Delivery))
+        DOUT("Outbox full, held message dropped");
+    }
+    else
+    {
+      DOUT("Maybe delivered, held message dropped");
+    }
+    releaseHeld(i);
+  }
+  TBCSentId* sent = sentId(chatId);
+  if (sent == 0)
+  {
+    sent = &SentIds[SentNext];
+    SentNext = (SentNext + 1) % TBC_SENT_CHATS;
+    sent->ChatId = chatId;
+  }
+  sent->MessageId = messageId;
 }
 
 TBCKeyBoard::TBCKeyBoard(uint count, bool oneTime, bool resize)
@@ -321,4 +1482,4 @@ const int TBCKeyBoard::length ()
   return Count;
 }
 
-
+
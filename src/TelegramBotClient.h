@@ -18,20 +18,120 @@
 #include <Client.h>
 #include <ArduinoJson.h>
 #include "JsonWebClient.h"
-
-#define TELEGRAMHOST F("api.telegram.org")
+#include "TBCOffsetStore.h"
+#include "TBCLatency.h"
+#include "TBCMutex.h"
+#include "TBCCommandRouter.h"
+
+/** Name of Telegram's API host */
+#define TBC_TELEGRAM_HOST "api.telegram.org"
+#define TELEGRAMHOST F(TBC_TELEGRAM_HOST)
 #define TELEGRAMPORT 443
+#ifndef POLLINGTIMEOUT
 #define POLLINGTIMEOUT 600
+#endif
+/** Minimum timeout in seconds of adaptive long polls */
+#ifndef TBC_MIN_POLL_TIMEOUT
+#define TBC_MIN_POLL_TIMEOUT 20
+#endif
+/** Time in seconds the response to a long poll may be late
+    before the connection is considered dead */
+#ifndef TBC_POLL_GRACE
+#define TBC_POLL_GRACE 10
+#endif
+/** Number of long polls completed in a row before an adaptive
+    timeout is increased */
+#ifndef TBC_POLL_GROW_AFTER
+#define TBC_POLL_GROW_AFTER 3
+#endif
 #define USERAGENTSTRING F("telegrambotclient /0.1")
+/** Maximum length of a text message accepted by Telegram */
+#define TBC_MAX_MESSAGE_LENGTH 4096
+
+#ifndef TBC_OUTBOX_SIZE
+#ifdef ESP8266
+#define TBC_OUTBOX_SIZE 4
+#else
+#define TBC_OUTBOX_SIZE 8
+#endif
+#endif
 
-// Inspired by PubSubClient by Nick O'Leary (http://knolleary.net)
+#ifndef TBC_UPLOAD_CHUNK
 #ifdef ESP8266
-#include <functional>
-#define TBC_CALLBACK_RECEIVE_SIGNATURE std::function<void(TelegramProcessError, JwcProcessError, Message*)> callbackReceive
-#define TBC_CALLBACK_ERROR_SIGNATURE std::function<void(TelegramProcessError, JwcProcessError)> callbackError
+#define TBC_UPLOAD_CHUNK 256
 #else
-#define TBC_CALLBACK_RECEIVE_SIGNATURE void (*callbackReceive)(TelegramProcessError, JwcProcessError, Message*)
-#define TBC_CALLBACK_ERROR_SIGNATURE void (*callbackError)(TelegramProcessError, JwcProcessError)
+#define TBC_UPLOAD_CHUNK 512
+#endif
+#endif
+
+/** Boundary separating the parts of multipart/form-data uploads */
+#define TBC_BOUNDARY "----TelegramBotClientBoundary7MA4YWxk"
+
+/** Characters of a message sent by postText(), counted in UTF-16 code
+    units like Telegram does, at most TBC_MAX_MESSAGE_LENGTH */
+#ifndef TBC_TEXT_PART
+#ifdef ESP8266
+#define TBC_TEXT_PART 1024
+#else
+#define TBC_TEXT_PART TBC_MAX_MESSAGE_LENGTH
+#endif
+#endif
+
+/** Number of messages kept until their delivery is known */
+#ifndef TBC_HELD_SIZE
+#ifdef ESP8266
+#define TBC_HELD_SIZE 2
+#else
+#define TBC_HELD_SIZE 4
+#endif
+#endif
+
+/** Number of chats the id of the last posted message is kept of */
+#ifndef TBC_SENT_CHATS
+#ifdef ESP8266
+#define TBC_SENT_CHATS 4
+#else
+#define TBC_SENT_CHATS 8
+#endif
+#endif
+
+/** Time in seconds a post may wait for its response before the
+    connection is considered dead */
+#ifndef TBC_POST_TIMEOUT
+#define TBC_POST_TIMEOUT 30
+#endif
+
+/** Time in milliseconds a message of unknown delivery is kept
+    waiting for the next message to its chat to prove it absent */
+#ifndef TBC_PROOF_TIMEOUT
+#define TBC_PROOF_TIMEOUT 60000
+#endif
+
+/** Minimum time in milliseconds between two posts, Telegram allows
+    about 30 messages per second to different chats */
+#ifndef TBC_POST_INTERVAL
+#define TBC_POST_INTERVAL 35
+#endif
+
+/** Time in milliseconds to wait before posting spooled messages again
+    after a post could not be started */
+#ifndef TBC_SPOOL_RETRY
+#define TBC_SPOOL_RETRY 5000
+#endif
+
+/** Maximum size of a poll response, see TelegramBotClient::setBuffers() */
+#ifndef TBC_POLL_BUFF_SIZE
+#define TBC_POLL_BUFF_SIZE JWC_BUFF_SIZE
+#endif
+
+/** Maximum size of a post response, Telegram echoes the message sent */
+#ifndef TBC_POST_BUFF_SIZE
+#define TBC_POST_BUFF_SIZE JWC_BUFF_SIZE
+#endif
+
+/** Initial size of the json buffer serializing a message, grows if needed */
+#ifndef TBC_JSON_BUFF_SIZE
+#define TBC_JSON_BUFF_SIZE 256
 #endif
 
 #ifndef uint
@@ -68,13 +168,13 @@ enum class TelegramProcessError : int
   RetPostErr = -4
 };
 
-/** Static list of JwcClientState names */
-static String TelegramProcessErrorString[] = {"Ok", "JcwPollErr", "JcwPostErr", "RetPollErr", "RetPostErr"};
+/**
+    \brief Name of a TelegramProcessError
 
-static String toString(TelegramProcessError err)
-{
-  return TelegramProcessErrorString[(-1) * (int) err];
-}
+    \param [in] err The error
+    \return The name stored in flash
+*/
+const __FlashStringHelper* toString(TelegramProcessError err);
 
 /**
    \struct Message
@@ -148,6 +248,59 @@ struct Message {
       Date the message was sent in Unix time
   */
   long Date;
+  /** file_id: document/file_id or photo/file_id of the largest photo size
+      Optional. Identifier of an attached file, used to download it by
+      TelegramBotClient::downloadFile() */
+  String FileId;
+  /** file_name: document/file_name
+      Optional. Original filename as defined by sender */
+  String FileName;
+  /** mime_type: document/mime_type
+      Optional. MIME type of the file as defined by sender */
+  String MimeType;
+  /** file_size: document/file_size or photo/file_size
+      Optional. File size in bytes */
+  long FileSize;
+  /** caption: caption
+      Optional. Caption of the document or photo, 0-1024 characters */
+  String Caption;
+};
+
+/** Callback called on receiving a message */
+typedef TBCDelegate<void(TelegramProcessError, JwcProcessError, Message*)> TBCReceiveCallback;
+/** Callback called on error */
+typedef TBCDelegate<void(TelegramProcessError, JwcProcessError)> TBCErrorCallback;
+/** Callback called on download progress with the bytes received and the file size */
+typedef TBCDelegate<void(TelegramProcessError, JwcProcessError, size_t, size_t)> TBCDownloadCallback;
+
+/**
+   \class TBCDownloadState
+   @enum mapper::TBCDownloadState
+
+   \file TelegramBotClient.h
+
+   \brief TBCDownloadState state = TBCDownloadState::Idle;
+
+   Enumeration to indicate the progress of a file download.
+
+   \note Should only be used as a part of TelegramBotClient
+   (https://github.com/schlingensiepen/TelegramBotClient)
+
+   \author Jörn Schlingensiepen <joern@schlingensiepen.com>
+
+*/
+enum class TBCDownloadState : int
+{
+  /** No download running */
+  Idle = 0,
+  /** Download requested, waiting for the post client */
+  Queued = 1,
+  /** getFile was called, waiting for the file path */
+  FileInfo = 2,
+  /** File path is known, waiting for the post client */
+  Ready = 3,
+  /** File is downloaded */
+  Data = 4
 };
 
 /**
@@ -293,6 +446,128 @@ class TBCKeyBoard
 
 };
 
+/**
+   \class TBCPriority
+   @enum mapper::TBCPriority
+
+   \file TelegramBotClient.h
+
+   \brief TBCPriority priority = TBCPriority::Alarm;
+
+   Enumeration of the classes queued messages are posted in, a
+   message is posted before all messages of lower classes.
+
+   \note Should only be used as a part of TelegramBotClient
+   (https://github.com/schlingensiepen/TelegramBotClient)
+
+   \author Jörn Schlingensiepen <joern@schlingensiepen.com>
+
+*/
+enum class TBCPriority : int
+{
+  /** Alerts, posted first, before uploads and downloads and never coalesced */
+  Alarm = 0,
+  /** Messages posted by default */
+  Normal = 1,
+  /** Bulk messages, posted when nothing else is queued */
+  Chatter = 2
+};
+
+/**
+   \class TBCDelivery
+   @enum mapper::TBCDelivery
+
+   \file TelegramBotClient.h
+
+   \brief TBCDelivery delivery = TBCDelivery::AtLeastOnce;
+
+   Enumeration of the guarantees of a message whose post was not
+   answered, e.g. because the connection was lost after the request
+   was sent. Telegram may or may not have delivered it.
+
+   \note Should only be used as a part of TelegramBotClient
+   (https://github.com/schlingensiepen/TelegramBotClient)
+
+   \author Jörn Schlingensiepen <joern@schlingensiepen.com>
+
+*/
+enum class TBCDelivery : int
+{
+  /** Posted again only if the id of the next message posted to the
+      chat proves it was not delivered, never duplicated */
+  AtMostOnce = 0,
+  /** Posted again, never lost but may be duplicated */
+  AtLeastOnce = 1
+};
+
+/**
+   \struct TBCSentId
+
+   \file TelegramBotClient.h
+
+   \brief Id of the last message posted to a chat
+
+   Telegram numbers the messages of a chat consecutively. A message
+   posted with the next id after the last known one proves that no
+   message of unknown delivery was posted in between.
+
+   \note Should only be used as a part of TelegramBotClient
+   (https://github.com/schlingensiepen/TelegramBotClient)
+
+   \author Jörn Schlingensiepen <joern@schlingensiepen.com>
+
+*/
+struct TBCSentId
+{
+  /** Id of the chat, 0 if unused */
+  long ChatId = 0;
+  /** Id of the last message posted to the chat */
+  long MessageId = 0;
+};
+
+/**
+   \struct TBCOutMessage
+
+   \file TelegramBotClient.h
+
+   \brief Outgoing Telegram Message
+
+   Struct to store a message queued by postMessage() until
+   it is sent by loop().
+
+   \note Should only be used as a part of TelegramBotClient
+   (https://github.com/schlingensiepen/TelegramBotClient)
+
+   \author Jörn Schlingensiepen <joern@schlingensiepen.com>
+
+*/
+struct TBCOutMessage
+{
+  /** Id of the chat the message shall be sent to */
+  long ChatId;
+  /** Text of the message */
+  String Text;
+  /** Json members describing the keyboard, empty if none */
+  String KeyBoard;
+  /** millis() when the message was queued */
+  unsigned long Queued;
+  /** Class the message is posted in */
+  TBCPriority Priority;
+  /** Guarantee if the post is not answered */
+  TBCDelivery Delivery;
+  /** Id of the last message known to be posted to the chat when the
+      post was lost, if held */
+  long ProofId;
+  /** millis() when the post was lost, if held */
+  unsigned long Lost;
+  /** Indicates the message replies to an update measured by TBCLatency */
+  bool Traced;
+  /** micros() when the message was queued, if Traced */
+  unsigned long QueuedMicros;
+  /** Local origin of the update replied to, if Traced */
+  unsigned long Origin;
+};
+
 /**
    \class TelegramBotClient
 
@@ -308,6 +583,9 @@ class TBCKeyBoard
    \author Jörn Schlingensiepen <joern@schlingensiepen.com>
 
 */
+class TBCDispatcher;
+class TBCSpool;
+
 class TelegramBotClient
 {
   private:
@@ -315,6 +593,40 @@ class TelegramBotClient
         messages more recent than the last received.
     */
     long LastUpdateId = 0;
+    /** Store persisting LastUpdateId, 0 if not persisted */
+    TBCOffsetStore* OffsetStore = 0;
+    /** Dispatcher calling callbackReceive in workers, 0 to call it in loop() */
+    TBCDispatcher* Dispatcher = 0;
+    /** Histograms of the stages of updates, 0 if not measured */
+    TBCLatency* Latency = 0;
+    /** Spool of messages that could not be posted, 0 to drop them */
+    TBCSpool* Spool = 0;
+    /** Protects the client if it is used by several threads */
+    TBCMutex Mutex;
+    /** Router of commands, created by the first onCommand() */
+    TBCCommandRouter* Router = 0;
+    /**
+        \brief Checks the dispatcher can take an update
+
+        \return True if no dispatcher is used or its queues have space
+    */
+    bool dispatchReady();
+    /** Timeout of long polls in seconds */
+    unsigned int PollTimeout = POLLINGTIMEOUT;
+    /** Maximum timeout of long polls in seconds */
+    unsigned int MaxPollTimeout = POLLINGTIMEOUT;
+    /** Indicates the timeout is adapted to the connection */
+    bool AdaptivePolling = false;
+    /** Longest time in seconds a long poll survived */
+    unsigned int SurvivedIdle = 0;
+    /** Shortest timeout in seconds a long poll was dropped at, 0 if none */
+    unsigned int DropLimit = 0;
+    /** Number of long polls completed in a row */
+    uint PollsCompleted = 0;
+    /** Indicates updates arrive in a burst, polls return immediately */
+    bool Burst = false;
+    /** millis() when the current poll was started */
+    unsigned long PollStart = 0;
     /** Secure Token provided by BotFather */
     String Token;
     /** Indicates if the client uses two underlying client objects
@@ -327,6 +639,84 @@ class TelegramBotClient
         same Client object than SslPollClient
     */
     JsonWebClient* SslPostClient;
+    /** Ring buffer of messages waiting to be posted */
+    TBCOutMessage Outbox[TBC_OUTBOX_SIZE];
+    /** Index of the oldest message in Outbox */
+    uint OutboxHead = 0;
+    /** Number of messages stored in Outbox */
+    uint OutboxCount = 0;
+    /** Time window in milliseconds messages to the same chat are
+        merged in, 0 disables coalescing */
+    unsigned long CoalesceWindow = 0;
+    /** Minimum time in milliseconds between two posts */
+    unsigned long PostInterval = TBC_POST_INTERVAL;
+    /** millis() when the last post was started */
+    unsigned long LastPost = 0;
+    /** Additional time in milliseconds to wait before the next post
+        as requested by the server */
+    unsigned long PostPause = 0;
+    /** Time in milliseconds to wait before the next poll
+        as requested by the server */
+    unsigned long PollPause = 0;
+    /** Http status code of the last failed call */
+    int HttpStatus = 0;
+    /** Maximum number of posts sent without waiting for a response */
+    uint8_t PipelineDepth = 1;
+    /** Number of messages at the head of Outbox sent without
+        response received yet */
+    uint OutboxInFlight = 0;
+    /** Messages of unknown delivery waiting for a proof */
+    TBCOutMessage Held[TBC_HELD_SIZE];
+    /** Number of messages in Held */
+    uint HeldCount = 0;
+    /** Ids of the last messages posted to recent chats */
+    TBCSentId SentIds[TBC_SENT_CHATS];
+    /** Index of the entry of SentIds replaced next */
+    uint SentNext = 0;
+    /** Chats of the running broadcast, 0 if no broadcast is running */
+    long* BroadcastIds = 0;
+    /** Number of chats in BroadcastIds */
+    uint BroadcastCount = 0;
+    /** Index of the next chat in BroadcastIds to post to */
+    uint BroadcastIndex = 0;
+    /** Number of chats in BroadcastIds a response was received for */
+    uint BroadcastAcked = 0;
+    /** Json of the broadcast message following the chat_id member */
+    String BroadcastBody;
+    /** Source of the running upload, 0 if all data was sent */
+    Stream* UploadSource = 0;
+    /** Number of bytes still to be read from UploadSource */
+    size_t UploadRemaining = 0;
+    /** Parts of the upload preceding the data, empty once the upload started */
+    String UploadHead;
+    /** Bot API method called by the upload */
+    const __FlashStringHelper* UploadMethod = 0;
+    /** Indicates the upload was sent and waits for its response */
+    bool UploadInFlight = false;
+    /** Source of the running long text, 0 if none is read */
+    Stream* TextSource = 0;
+    /** Number of bytes still to be read from TextSource */
+    size_t TextRemaining = 0;
+    /** Bytes of the long text read but not queued yet */
+    String TextBuffer;
+    /** Offset of the next part in TextBuffer */
+    size_t TextOffset = 0;
+    /** Id of the chat the long text is sent to */
+    long TextChatId = 0;
+    /** Class the parts of the long text are posted in */
+    TBCPriority TextPriority = TBCPriority::Normal;
+    /** Guarantee of the parts of the long text */
+    TBCDelivery TextDelivery = TBCDelivery::AtMostOnce;
+    /** State of the running download */
+    TBCDownloadState DownloadState = TBCDownloadState::Idle;
+    /** File id of the download, replaced by the file path by getFile */
+    String DownloadFile;
+    /** Size of the downloaded file as reported by getFile */
+    size_t DownloadSize = 0;
+    /** Sink receiving the downloaded file */
+    Print* DownloadSink = 0;
+    /** Callback called on download progress */
+    TBCDownloadCallback callbackDownload;
 
     /**
         \brief Starts polling
@@ -336,20 +726,326 @@ class TelegramBotClient
         \details Starts the polling by open a http long call
     */
     void startPolling();
+    /**
+        \brief Checks the running poll for a silently dropped connection
+
+        \return Return true if the poll was dropped
+
+        \details A poll the server did not answer within its timeout plus
+        TBC_POLL_GRACE seconds is stopped, the connection is considered dead.
+    */
+    bool checkPoll();
+    /**
+        \brief Adapts the poll timeout after a poll completed
+
+        \param [in] update True if the poll returned an update
+        \return Nothing
+    */
+    void pollCompleted(bool update);
+    /**
+        \brief Adapts the poll timeout after a poll was dropped
+
+        \return Nothing
+    */
+    void pollDropped();
+    /**
+        \brief Sets the id of the next update to receive
+
+        \param [in] updateId Id of the next update
+        \return Nothing
+
+        \details Sets LastUpdateId and records it in the offset store
+    */
+    void setLastUpdateId(long updateId);
     /**
         \brief Starts posting a message
 
         \param [in] The Message to post as json string
-        \return Nothing
+        \return Returns false if the post could not be started
 
         \details Start the posting of a message by
         open a http post call
     */
-    void startPosting(String Message);
+    bool startPosting(String Message);
+    /**
+        \brief Starts a post call
+
+        \param [in] method Name of the bot API method to call
+        \param [in] contentType Content type of the body
+        \param [in] length Length of the body in bytes
+        \return Returns true if the body can be written to SslPostClient
+
+        \details Connects the post client and writes the http headers
+        of a post call, the caller writes the body and ends the request.
+    */
+    bool beginPosting(
+      const __FlashStringHelper* method,
+      const __FlashStringHelper* contentType,
+      size_t length);
+    /**
+        \brief Posts the broadcast message to the next chat
+
+        \return Nothing
+
+        \details Writes the chat_id of the next chat and the
+        serialized broadcast message to the post client.
+    */
+    void postBroadcast();
+    /**
+        \brief Checks if a post can be started
+
+        \return Returns true if the post client is idle and
+        the post interval has passed
+    */
+    bool readyToPost();
+    /**
+        \brief Takes the shared connection for a post
+
+        \return Returns false if a poll response is being received
+
+        \details Only used if the poll and the post client share one
+        Client. A long poll still waiting for the server is stopped,
+        its update is not acknowledged and returned by the next poll.
+        A poll receiving its response is finished first.
+    */
+    bool claimConnection();
+    /**
+        \brief Checks for posts not started yet
+
+        \return True if messages, a broadcast, an upload or a
+        download request wait for the post client
+    */
+    bool postQueued();
+    /**
+        \brief Checks the next queued message is an alarm
+
+        \return True if a message of TBCPriority::Alarm is queued
+    */
+    bool alarmQueued();
+    /**
+        \brief Checks an upload or download uses the post client
+
+        \return True if a transfer was started and is not finished
+    */
+    bool transferRunning();
+    /**
+        \brief Handles the response to a post
+
+        \return Nothing
+
+        \details Removes the oldest message in flight, responses
+        arrive in the order the messages were posted.
+    */
+    void completePost();
+    /**
+        \brief Removes the oldest message from the outbox
+
+        \return Nothing
+    */
+    void popOutbox();
+    /**
+        \brief Checks the running post for a silently dropped connection
+
+        \return Return true if the post was dropped
+
+        \details A post not answered within TBC_POST_TIMEOUT seconds is
+        stopped and handled like a lost connection. Uploads and
+        downloads are not checked.
+    */
+    bool checkPost();
+    /**
+        \brief Handles the posts lost with the connection
+
+        \param refused true if the oldest post in flight was answered
+        as not delivered (HTTP 429), it is posted again in any case
+
+        \return Nothing
+
+        \details Messages of TBCDelivery::AtLeastOnce are posted again,
+        the others are held until their delivery is known.
+    */
+    void postLost(bool refused = false);
+    /**
+        \brief Keeps a message of unknown delivery
+
+        \param [in] msg The message
+        \return Nothing
+
+        \details Dropped if no id of the chat is known to prove it.
+    */
+    void holdMessage(const TBCOutMessage& msg);
+    /**
+        \brief Removes a held message
+
+        \param [in] index Index in Held
+        \return Nothing
+    */
+    void releaseHeld(uint index);
+    /**
+        \brief Drops held messages not proven within TBC_PROOF_TIMEOUT
+
+        \return Nothing
+    */
+    void expireHeld();
+    /**
+        \brief Records the id of a message acknowledged by the server
+
+        \param [in] chatId Id of the chat
+        \param [in] messageId Id of the message
+        \return Nothing
+
+        \details Resolves the held messages of the chat: a message
+        following the last known one directly proves they were not
+        delivered, they are posted again, otherwise they are dropped.
+    */
+    void acked(long chatId, long messageId);
+    /**
+        \brief Id of the last message posted to a chat
+
+        \param [in] chatId Id of the chat
+        \return The entry of the chat, 0 if not known
+    */
+    TBCSentId* sentId(long chatId);
+    /**
+        \brief Queues or spools a message
+
+        \param [in] chatId Id of the chat the message shall be sent to.
+        \param [in] text Text of the message
+        \param [in] keyBoard Json members describing the keyboard
+        \param [in] priority Class the message is posted in
+        \param [in] delivery Guarantee if the post is not answered
+        \return Returns false if the message was dropped
+    */
+    bool storeMessage(long chatId, const String& text, const String& keyBoard,
+                      TBCPriority priority, TBCDelivery delivery);
+    /**
+        \brief Moves the queued messages of the outbox to the spool
+
+        \return Nothing
+
+        \details Called if a post could not be started, the messages
+        are posted again after TBC_SPOOL_RETRY milliseconds.
+    */
+    void spoolOutbox();
+    /**
+        \brief Moves spooled messages to the outbox
+
+        \return Nothing
+
+        \details Fills the outbox unless posting is paused.
+    */
+    void unspool();
+    /**
+        \brief Releases the broadcast if all chats are done
+
+        \return Nothing
+    */
+    void checkBroadcast();
+    /**
+        \brief Queues an upload
+
+        \param [in] method Bot API method to call
+        \param [in] field Name of the form field holding the file
+        \param [in] chatId Id of the chat the file shall be sent to.
+        \param [in] source Stream providing the content of the file
+        \param [in] length Number of bytes to read from source
+        \param [in] fileName Name of the file
+        \param [in] caption Caption of the file, not sent if empty
+        \return Returns false if another upload is running
+    */
+    bool sendFile(
+      const __FlashStringHelper* method,
+      const __FlashStringHelper* field,
+      long chatId, Stream& source, size_t length,
+      const String& fileName, const String& caption);
+    /**
+        \brief Continues the running upload
+
+        \return Return true if an action was performed
+
+        \details Starts the upload when the post client is idle and
+        copies the next chunk of TBC_UPLOAD_CHUNK bytes from the source.
+    */
+    bool processUpload();
+    /**
+        \brief Queues the next part of the running long text
+
+        \return Return true if a part was queued
+
+        \details Waits until every queued message was sent, so at most
+        one part is held besides the posts in flight. A part ends at
+        the last line break, else at the last space, else at the last
+        character fitting into TBC_TEXT_PART.
+    */
+    bool processText();
+    /**
+        \brief Appends the next chunk of the long text to TextBuffer
+
+        \return Return false if the source is drained or has no
+        data available yet
+    */
+    bool readText();
+    /**
+        \brief Aborts the running upload
+
+        \param [in] err Error reported to callbackError
+        \return Nothing
+    */
+    void abortUpload(JwcProcessError err);
+    /**
+        \brief Continues the running download
+
+        \return Return true if a request was sent
+
+        \details Calls getFile or requests the file from the
+        file server when the post client is idle.
+    */
+    bool processDownload();
+    /**
+        \brief Handles the response to a download request
+
+        \param [in] json Response of getFile, invalid after the file was received
+        \return Nothing
+    */
+    void downloadSuccess(JsonObject& json);
+    /**
+        \brief Aborts the running download
+
+        \param [in] tbcErr Error reported to callbackDownload
+        \param [in] jwcErr Error reported to callbackDownload
+        \return Nothing
+    */
+    void abortDownload(TelegramProcessError tbcErr, JwcProcessError jwcErr);
+    /**
+        \brief Queues a message
+
+        \param [in] chatId Id of the chat the message shall be sent to.
+        \param [in] text Text of the message
+        \param [in] keyBoard Json members describing the keyboard
+        \param [in] priority Class the message is posted in
+        \param [in] delivery Guarantee if the post is not answered
+        \return Returns false if the outbox is full
+
+        \details Inserts a message behind the queued messages of its
+        class, in coalescing mode it is merged into the last of them
+        if possible.
+    */
+    bool queueMessage(long chatId, const String& text, const String& keyBoard,
+                      TBCPriority priority, TBCDelivery delivery);
+    /**
+        \brief Sends the oldest queued message
+
+        \return Return true if a message was sent
+
+        \details Sends the oldest message of the highest class in the
+        outbox if the post client is idle and the coalescing window has
+        passed.
+    */
+    bool processOutbox();
     /** Callback called on receiving a message */
-    TBC_CALLBACK_RECEIVE_SIGNATURE;
+    TBCReceiveCallback callbackReceive;
     /** Callback called on error */
-    TBC_CALLBACK_ERROR_SIGNATURE;
+    TBCErrorCallback callbackError;
   public:
     /**
         \brief Constructor
@@ -358,17 +1054,17 @@ class TelegramBotClient
         \param token secure token for your bot provided by BotFather.
         \param sslPollClient SSL client used for polling messages from remote server
         \param sslPostClient SSL client used for posting messages to remote server
-        \param TBC_CALLBACK_RECEIVE_SIGNATURE
+        \param callbackReceive
         Callback called on receiving a message
-        \param TBC_CALLBACK_ERROR_SIGNATURE
+        \param callbackError
         Callback called on error while receiving
     */
     TelegramBotClient (
       String token,
       Client& sslPollClient,
       Client& sslPostClient,
-      TBC_CALLBACK_RECEIVE_SIGNATURE,
-      TBC_CALLBACK_ERROR_SIGNATURE
+      TBCReceiveCallback callbackReceive,
+      TBCErrorCallback callbackError
     );
     /**
         \brief Constructor
@@ -386,10 +1082,12 @@ class TelegramBotClient
     /**
         \brief Constructor
         \details Constructor, initializing only members no callbacks
-                 using the same client for posting and polling
+                 using the same client for posting and polling.
+                 Queued posts are sent before the next poll, a long poll
+                 still waiting for the server is stopped for them, a poll
+                 receiving its response is finished first.
         \param token secure token for your bot provided by BotFather.
-        \param sslPollClient SSL client used for polling messages from remote server
-        \param sslPostClient SSL client used for posting messages to remote server
+        \param sslPollClient SSL client used for polling and posting
     */
     TelegramBotClient (
       String token,
@@ -404,66 +1102,484 @@ class TelegramBotClient
     /**
         \brief Alias for setCallbacks following Arduino convention
 
-        \param [in] TBC_CALLBACK_RECEIVE_SIGNATURE
+        \param [in] callbackReceive
         Callback called on receiving a message
-        \param [in] TBC_CALLBACK_ERROR_SIGNATURE
+        \param [in] callbackError
         Callback called on error while receiving
         \return Nothing
 
         \details Alias for setCallbacks following Arduino convention
-        sets callbacks
+        sets callbacks and loads the update offset from the offset store
     */
     void begin(
-      TBC_CALLBACK_RECEIVE_SIGNATURE,
-      TBC_CALLBACK_ERROR_SIGNATURE);
+      TBCReceiveCallback callbackReceive,
+      TBCErrorCallback callbackError);
+    /**
+        \brief Sets a store persisting the update offset
+
+        \param [in] store Store used to persist the offset, 0 to disable
+        \return Nothing
+
+        \details The offset is loaded from the store by begin() and
+        written after each update was processed, thus updates are not
+        received again after a restart. Shall be called before begin().
+    */
+    void setOffsetStore(TBCOffsetStore* store);
+    /**
+        \brief Sets a spool storing messages that could not be posted
+
+        \param [in] spool Spool of messages, 0 to drop them
+        \return Nothing
+
+        \details Messages are spooled if the outbox is full or if a
+        post could not be started, e.g. while the connection is down.
+        Later messages are spooled behind them, alarms pass them. The
+        spooled messages are loaded by begin(), thus shall be called
+        before begin().
+    */
+    void setSpool(TBCSpool* spool);
+    /**
+        \brief Sets histograms measuring the stages of updates
+
+        \param [in] latency Histograms to fill, 0 to stop measuring
+        \return Nothing
+
+        \details Replies posted by the callback of an update are
+        followed until their post is acknowledged. Callbacks run by a
+        TBCDispatcher are not measured.
+    */
+    void setLatency(TBCLatency* latency);
     /**
         \brief Sets callbacks
 
-        \param [in] TBC_CALLBACK_RECEIVE_SIGNATURE
+        \param [in] callbackReceive
         Callback called on receiving a message
-        \param [in] TBC_CALLBACK_ERROR_SIGNATURE
+        \param [in] callbackError
         Callback called on error while receiving
         \return Nothing
 
         \details sets callbacks for receiving message and error handling
     */
     void setCallbacks(
-      TBC_CALLBACK_RECEIVE_SIGNATURE,
-      TBC_CALLBACK_ERROR_SIGNATURE);
+      TBCReceiveCallback callbackReceive,
+      TBCErrorCallback callbackError);
 
     /**
         \brief Handles client background tasks
 
+        \param [in] budgetMicros Optional. Time in microseconds the network
+        processing may take, 0 to process all data available.
         \return Return true is an action was needed and performed
 
         \details Handles client background tasks, shall be calles in every main loop()
+        It never waits for data, see JsonWebClient::loop() for the budget.
+    */
+    bool loop(unsigned long budgetMicros = 0);
+    /**
+        \brief Enables coalescing of messages
+
+        \param [in] window Time window in milliseconds, 0 disables coalescing
+        \return Nothing
+
+        \details Messages posted to the same chat within the time window
+        are merged into one message (separated by a new line) as long as
+        they carry the same keyboard and fit into TBC_MAX_MESSAGE_LENGTH.
+        Each message is delayed by up to the time window.
+    */
+    void setCoalescing(unsigned long window);
+    /**
+        \brief Sets the rate limit for posting
+
+        \param [in] interval Minimum time in milliseconds between two posts
+        \return Nothing
+
+        \details Queued messages and broadcasts are not posted faster
+        than one message per interval, defaults to TBC_POST_INTERVAL.
+    */
+    void setPostInterval(unsigned long interval);
+    /**
+        \brief Enables pipelining of posts
+
+        \param [in] depth Maximum number of posts sent without waiting for
+        a response, 1 disables pipelining
+        \return Nothing
+
+        \details In pipelining mode the post connection is kept alive and
+        up to depth messages are written back to back. Responses are
+        matched to the messages in the order they were sent. If the server
+        closes the connection while messages are pending, the TBCDelivery
+        of each message decides: TBCDelivery::AtLeastOnce messages are
+        sent again on a new connection (they may be delivered twice),
+        TBCDelivery::AtMostOnce messages, the default, are held until the
+        next message id of their chat proves they were not delivered.
+        Pending broadcasts are sent again. Requires different clients for posting and polling, otherwise
+        pipelining stays disabled.
+    */
+    void setPipelining(uint8_t depth);
+    /**
+        \brief Sets the timeout of long polls
+
+        \param [in] timeout Timeout in seconds, in adaptive mode the maximum
+        \param [in] adaptive Optional. Adapt the timeout to the connection
+        \return Nothing
+
+        \details Telegram keeps a poll open for timeout seconds if no update
+        arrives. NATs and mobile carriers may drop idle connections silently
+        before: a poll not answered within timeout + TBC_POLL_GRACE seconds
+        is restarted. In adaptive mode the timeout is reduced below the
+        longest idle period the connection survived after a drop and
+        increased again after TBC_POLL_GROW_AFTER completed polls, never
+        reaching a timeout that was dropped before.
+        Independent of this setting polls return immediately while a burst
+        of updates is received. Defaults to POLLINGTIMEOUT.
     */
-    bool loop();
+    void setPollTimeout(unsigned int timeout, bool adaptive = false);
+    /**
+        \brief Current timeout of long polls
+
+        \return Timeout in seconds
+    */
+    unsigned int pollTimeout() {
+      return PollTimeout;
+    }
+    /**
+        \brief Http status code of the last failed call
+
+        \return The status code, 0 if no status line was received
+
+        \details Valid in callbackError, distinguishes e.g. 429 (too many
+        requests, the client waits as requested by Retry-After) from 502
+        (bad gateway).
+    */
+    int httpStatus() {
+      return HttpStatus;
+    }
+    /**
+        \brief Acknowledgement of the last post
+
+        \return ok, message_id, error_code and description of the
+        last response to a post
+
+        \details Valid in callbackError, e.g. the description of a 400
+        (bad request). Posts are acknowledged by a filtered scan, the
+        echoed message is never parsed.
+    */
+    const JwcAck& lastAck() {
+      return SslPostClient->ack();
+    }
+    /**
+        \brief Asks Telegram for compressed updates
+
+        \param [in] compression True to receive gzip compressed updates
+        \return Nothing
+
+        \details Compressed polls save bandwidth on metered links at the
+        cost of inflating each response, the decompressed response still
+        has to fit into the poll buffer.
+    */
+    void setCompression(bool compression);
+    /**
+        \brief Sets a hook called at the stages of the connections
+
+        \param [in] callbackConnection Hook called for the poll and the
+        post connection, e.g. TBCSessionCache::hook()
+        \return Nothing
+    */
+    void setConnectionHook(JwcConnectionHook callbackConnection);
+    /**
+        \brief Sets a cache of Telegram's address
+
+        \param [in] cache Cache shared by the poll and the post
+        connection, 0 to connect by name
+        \return Nothing
+
+        \details See JsonWebClient::setAddressCache() for the name
+        sent as SNI when connecting by address.
+    */
+    void setAddressCache(TBCAddressCache* cache);
+    /**
+        \brief Sets the maximum size of responses
+
+        \param [in] pollSize Maximum size of a poll response
+        \param [in] postSize Maximum size of a post response
+        \return Nothing
+
+        \details Defaults to TBC_POLL_BUFF_SIZE and TBC_POST_BUFF_SIZE,
+        each response allocates only its actual size.
+    */
+    void setBuffers(size_t pollSize, size_t postSize);
+    /**
+        \brief Sets static buffers of responses
+
+        \param [in] pollBuffer Buffer used for all poll responses
+        \param [in] postBuffer Buffer used for all post responses
+        \return Nothing
+
+        \details The buffers are not allocated per response, their
+        sizes are known at link time:
+        static JwcBuffer<2048> pollBuffer; static JwcBuffer<512> postBuffer;
+        bot.setBuffers(pollBuffer, postBuffer);
+    */
+    template <size_t POLL, size_t POST>
+    void setBuffers(JwcBuffer<POLL>& pollBuffer, JwcBuffer<POST>& postBuffer) {
+      SslPollClient->setBuffer(pollBuffer);
+      SslPostClient->setBuffer(postBuffer);
+    }
+    /**
+        \brief Registers a command handler
+
+        \param [in] command The command, e.g. "/start", shall stay valid
+        \param [in] callbackCommand Handler called instead of
+        callbackReceive for messages starting with the command
+        \return False if the command is registered already or
+        TBC_MAX_COMMANDS commands are registered
+
+        \details Messages not starting with a registered command are
+        passed to callbackReceive. See TBCCommandRouter. Commands shall be
+        registered before workers of a TBCDispatcher are started.
+    */
+    bool onCommand(const char* command, TBCCommandCallback callbackCommand);
+    /**
+        \brief Sets the name of the bot
+
+        \param [in] botName Name of the bot without @, shall stay valid
+        \return Nothing
+
+        \details Commands addressed to other bots, e.g. /start@otherbot
+        in groups, are passed to callbackReceive instead of the handler.
+    */
+    void setBotName(const char* botName);
+#ifdef TBC_THREADS
+    /**
+        \brief Handles received messages in worker threads
+
+        \param [in] dispatcher The TBCDispatcher, 0 to call callbackReceive in loop()
+        \return Nothing
+
+        \details Messages are passed to the dispatcher instead of
+        callbackReceive, the next poll starts when the dispatcher can
+        take another message. Posting from other threads is allowed
+        while a dispatcher is used.
+    */
+    void setDispatcher(TBCDispatcher* dispatcher);
+#endif
+    /**
+        \brief Number of bytes received
+
+        \return Number of bytes received by polls and posts
+    */
+    unsigned long bytesReceived() {
+      return SslPollClient->bytesReceived() + SslPostClient->bytesReceived();
+    }
+    /**
+        \brief Time spent processing responses
+
+        \return Time in microseconds spent on inflating and parsing responses
+    */
+    unsigned long processMicros() {
+      return SslPollClient->processMicros() + SslPostClient->processMicros();
+    }
+    /**
+        \brief Number of connects
+
+        \return Number of connects of polls and posts
+    */
+    unsigned long connects() {
+      return SslPollClient->connects() + SslPostClient->connects();
+    }
     /**
         \brief Post a message
 
         \param [in] chatId Id of the chat the message shall be sent to.
         \param [in] text Text of the message
         \param [in] keyBoard Optional. Keyboard to be send with this message.
-        \return Nothing
-
-        \details Post a message to a given chat. 
+        \param [in] priority Optional. Class the message is posted in.
+        \param [in] delivery Optional. Guarantee if the post is not answered.
+        \return Returns false if the message could not be queued
+
+        \details Post a message to a given chat. The message is queued
+        and sent by loop(), up to TBC_OUTBOX_SIZE messages can be queued.
+        Messages are posted by priority, in order within a class.
+        If the connection is lost before the response arrived, a message
+        of TBCDelivery::AtMostOnce is kept until the next message posted
+        to the chat: if that one got the id following the last known
+        one, the message was not delivered and is posted again. Messages
+        by other senders in between make the proof fail, the message is
+        dropped then. A message proven absent is posted out of order.
         (Only text messages and custom keyboards are supported, yet.)
     */
-    void postMessage(long chatId, String text, TBCKeyBoard& keyBoard);
+    bool postMessage(long chatId, String text, TBCKeyBoard& keyBoard,
+                     TBCPriority priority = TBCPriority::Normal,
+                     TBCDelivery delivery = TBCDelivery::AtMostOnce);
     /**
         \brief Post a message
 
         \param [in] chatId Id of the chat the message shall be sent to.
         \param [in] text Text of the message
-        \return Nothing
+        \param [in] priority Optional. Class the message is posted in.
+        \param [in] delivery Optional. Guarantee if the post is not answered.
+        \return Returns false if the message could not be queued
 
         \details Post a message to a given chat. 
         (Only text messages and custom keyboards are supported, yet.)
     */
 
-    void postMessage(long chatId, String text) {TBCKeyBoard keyBoard(0);
-      postMessage(chatId, text, keyBoard);
+    bool postMessage(long chatId, String text,
+                     TBCPriority priority = TBCPriority::Normal,
+                     TBCDelivery delivery = TBCDelivery::AtMostOnce) {TBCKeyBoard keyBoard(0);
+      return postMessage(chatId, text, keyBoard, priority, delivery);
+    }
+    /**
+        \brief Post a message to a list of chats
+
+        \param [in] chatIds Ids of the chats the message shall be sent to.
+        \param [in] count Number of ids in chatIds
+        \param [in] text Text of the message
+        \param [in] keyBoard Optional. Keyboard to be send with this message.
+        \return Returns false if another broadcast is still running
+
+        \details The message is serialized once, loop() posts it to one
+        chat after another patching only the chat_id, rate limited by
+        setPostInterval(). Messages queued by postMessage() are sent first.
+        The ids are copied, chatIds can be released after the call.
+    */
+    bool broadcast(const long chatIds[], uint count, String text, TBCKeyBoard& keyBoard);
+    /**
+        \brief Post a message to a list of chats
+
+        \param [in] chatIds Ids of the chats the message shall be sent to.
+        \param [in] count Number of ids in chatIds
+        \param [in] text Text of the message
+        \return Returns false if another broadcast is still running
+
+        \details See broadcast(const long[], uint, String, TBCKeyBoard&)
+    */
+    bool broadcast(const long chatIds[], uint count, String text) {TBCKeyBoard keyBoard(0);
+      return broadcast(chatIds, count, text, keyBoard);
+    }
+    /**
+        \brief Sends a file as document
+
+        \param [in] chatId Id of the chat the file shall be sent to.
+        \param [in] source Stream providing the content of the file
+        \param [in] length Number of bytes to read from source
+        \param [in] fileName Name of the file shown in the chat
+        \param [in] caption Optional. Caption of the document
+        \return Returns false if another upload is running
+
+        \details The file is sent as multipart/form-data by loop(),
+        it is copied in chunks of TBC_UPLOAD_CHUNK bytes and never held
+        in memory. The source has to stay valid until uploadPending()
+        returns false. Other messages are posted after the upload,
+        alarms queued before it starts are posted first.
+    */
+    bool sendDocument(long chatId, Stream& source, size_t length,
+                      String fileName, String caption = "") {
+      return sendFile(F("sendDocument"), F("document"),
+                      chatId, source, length, fileName, caption);
+    }
+    /**
+        \brief Sends a file as photo
+
+        \param [in] chatId Id of the chat the photo shall be sent to.
+        \param [in] source Stream providing the content of the image
+        \param [in] length Number of bytes to read from source
+        \param [in] fileName Name of the file, e.g. "snapshot.jpg"
+        \param [in] caption Optional. Caption of the photo
+        \return Returns false if another upload is running
+
+        \details See sendDocument()
+    */
+    bool sendPhoto(long chatId, Stream& source, size_t length,
+                   String fileName, String caption = "") {
+      return sendFile(F("sendPhoto"), F("photo"),
+                      chatId, source, length, fileName, caption);
+    }
+    /**
+        \brief Indicates a running upload
+
+        \return True while the source of the upload is in use
+    */
+    bool uploadPending() {
+      return UploadMethod != 0;
+    }
+    /**
+        \brief Sends a long text as consecutive messages
+
+        \param [in] chatId Id of the chat the text shall be sent to.
+        \param [in] source Stream providing the text encoded in UTF-8
+        \param [in] length Number of bytes to read from source
+        \param [in] priority Optional. Class the messages are posted in
+        \param [in] delivery Optional. Guarantee if a post is not answered
+        \return Returns false if another long text is running
+
+        \details The text is read in chunks of up to TBC_UPLOAD_CHUNK
+        bytes already available from the source by loop(), which never
+        waits for it, and split into messages of at most TBC_TEXT_PART
+        characters, preferably at line breaks. A part is read when the
+        previous one was sent, so texts of any size are sent in bounded
+        memory. The source has to stay valid until textPending()
+        returns false, which happens once length bytes were read.
+        Messages posted meanwhile may be sent between the parts.
+    */
+    bool postText(long chatId, Stream& source, size_t length,
+                  TBCPriority priority = TBCPriority::Normal,
+                  TBCDelivery delivery = TBCDelivery::AtMostOnce);
+    /**
+        \brief Sends a long text as consecutive messages
+
+        \param [in] chatId Id of the chat the text shall be sent to.
+        \param [in] text Text of any length
+        \param [in] priority Optional. Class the messages are posted in
+        \param [in] delivery Optional. Guarantee if a post is not answered
+        \return Returns false if another long text is running
+
+        \details See postText(long, Stream&, size_t, TBCPriority, TBCDelivery),
+        the text is copied once and split while it is sent.
+    */
+    bool postText(long chatId, const String& text,
+                  TBCPriority priority = TBCPriority::Normal,
+                  TBCDelivery delivery = TBCDelivery::AtMostOnce);
+    /**
+        \brief Indicates a running long text
+
+        \return True until the last part of the long text was queued
+    */
+    bool textPending() {
+      return TextRemaining > 0 || TextOffset < TextBuffer.length();
+    }
+    /**
+        \brief Downloads a file
+
+        \param [in] fileId Id of the file, see Message::FileId
+        \param [in] sink Print the content of the file is written to
+        \param [in] callbackDownload Optional.
+        Callback called with the bytes received so far and the file size
+        after each chunk and with an error code on failure
+        \return Returns false if another download is running
+
+        \details Calls getFile to get the path of the file and downloads it
+        by loop() using the post client. The content is written to sink in
+        chunks of JWC_RAW_CHUNK bytes, it is never held in memory. The sink
+        has to stay valid until downloadPending() returns false. The bot API
+        allows downloading files up to 20 MB.
+    */
+    bool downloadFile(String fileId, Print& sink, TBCDownloadCallback callbackDownload = 0);
+    /**
+        \brief Indicates a running download
+
+        \return True while the sink of the download is in use
+    */
+    bool downloadPending() {
+      return DownloadState != TBCDownloadState::Idle;
+    }
+    /**
+        \brief Number of chats the running broadcast still has to be sent to
+
+        \return Number of pending chats, 0 if no broadcast is running
+    */
+    uint broadcastPending() {
+      return BroadcastCount - BroadcastIndex;
     }
     /**
         \brief Callback called by JSONWebClient
@@ -514,33 +1630,21 @@ class TelegramBotClient
     */
     void postError(JwcProcessError err, Client* client);
 
-    static void callbackPollSuccess (void* obj, JwcProcessError err, JsonObject& json)
-    {
-      if (obj == 0) return;
-      TelegramBotClient* botClient = (TelegramBotClient*)obj;
-      botClient->pollSuccess(err, json);
-    }
-    static void callbackPollError(void* obj, JwcProcessError err, Client* client)
-    {
-      if (obj == 0) return;
-      TelegramBotClient* botClient = (TelegramBotClient*)obj;
-      botClient->pollError(err, client);
-    }
-    static void callbackPostSuccess (void* obj, JwcProcessError err, JsonObject& json)
-    {
-      if (obj == 0) return;
-      TelegramBotClient* botClient = (TelegramBotClient*)obj;
-      botClient->postSuccess(err, json);
-    }
-    static void callbackPostError(void* obj, JwcProcessError err, Client* client)
-    {
-      if (obj == 0) return;
-      TelegramBotClient* botClient = (TelegramBotClient*)obj;
-      botClient->postError(err, client);
-    }
+    /**
+        \brief Callback function reporting download progress
+
+        \param [in] received Number of bytes received
+        \param [in] total Content length, -1 if unknown
+        \return Nothing
+
+        \details This is an internal method called by underlying JSONWebClient
+
+        \note Do not call this method.
+    */
+    void postRaw(size_t received, long total);
 };
 
 #endif
 
 
-
+